@@ -0,0 +1,1349 @@
+//
+//  bench.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+/* benchmarks of the driver's hot paths. maschine-driver.c is compiled
+ * in, against the USB simulator, so that its static functions can be
+ * called:
+ *
+ *     cc -std=gnu11 -O2 -DUSB_SIMULATOR -I. -o simple-maschine-midi-bench bench/bench.c \
+ *         $(ls *.c | grep -v '^main.c$\|^maschine-driver.c$') $(pkg-config --cflags --libs alsa) -lpthread
+ *
+ * every result is printed as one JSON object per line on stdout, what the
+ * driver logs goes to stderr. Given a trace
+ * captured with simple-maschine-midi -c, it's also replayed as fast as
+ * possible, to measure parsing and dispatch on real traffic:
+ *
+ *     simple-maschine-midi-bench capture.trace
+ */
+
+#include "../maschine-driver.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { STREAM_SIZE = 64 * 1024 };
+enum { STREAM_ROUNDS = 200 };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* - allocations
+ *
+ * with glibc every malloc, calloc and realloc of the process is counted,
+ * elsewhere allocations are reported as null
+ */
+
+static uint64_t allocations;
+
+#if defined(__GLIBC__)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+static const int allocations_counted = 1;
+
+#else
+
+static const int allocations_counted = 0;
+
+#endif
+
+/* - */
+
+/* what happened between bench_begin and bench_end */
+typedef struct {
+    uint64_t elapsed;
+    uint64_t allocations;
+} bench_run;
+
+static void bench_begin(bench_run *run) {
+    run->allocations = allocations;
+    run->elapsed = now_ns();
+}
+
+static void bench_end(bench_run *run) {
+    run->elapsed = now_ns() - run->elapsed;
+    run->allocations = allocations - run->allocations;
+}
+
+static void report(const char *name, uint64_t ops, const bench_run *run) {
+    uint64_t elapsed = run->elapsed;
+    char allocations_per_op[32] = "null";
+    
+    if (allocations_counted)
+        snprintf(allocations_per_op, sizeof(allocations_per_op), "%.3f", (double)run->allocations / ops);
+    
+    printf(
+        "{\"bench\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_second\": %.0f, \"allocations_per_op\": %s}\n",
+        name,
+        (unsigned long long)ops,
+        (double)elapsed / ops,
+        ops * 1e9 / elapsed,
+        allocations_per_op
+    );
+}
+
+/* - midi parser */
+
+typedef struct {
+    uint8_t bytes[STREAM_SIZE];
+    int len;
+    int messages;
+} midi_stream;
+
+static uint64_t parsed_messages;
+static uint64_t parsed_bytes;
+
+static void count_message(uint8_t *buf, int len, void *user_data) {
+    parsed_messages++;
+    parsed_bytes += len;
+}
+
+/* every control change with its own status byte */
+static void stream_dense_cc(midi_stream *stream) {
+    stream->len = 0;
+    stream->messages = 0;
+    
+    while (stream->len + 3 <= STREAM_SIZE) {
+        stream->bytes[stream->len++] = 0xb0 | (stream->messages & 0x0f);
+        stream->bytes[stream->len++] = stream->messages % 120;
+        stream->bytes[stream->len++] = (stream->messages * 7) & 0x7f;
+        stream->messages++;
+    }
+}
+
+/* one status byte, then note on after note on */
+static void stream_running_status(midi_stream *stream) {
+    stream->len = 0;
+    stream->messages = 0;
+    
+    stream->bytes[stream->len++] = 0x90;
+    
+    while (stream->len + 2 <= STREAM_SIZE) {
+        stream->bytes[stream->len++] = 36 + (stream->messages % 16);
+        stream->bytes[stream->len++] = stream->messages & 1 ? 0 : 100;
+        stream->messages++;
+    }
+}
+
+/* 128 bytes sysex, each followed by a program change */
+static void stream_sysex(midi_stream *stream) {
+    stream->len = 0;
+    stream->messages = 0;
+    
+    while (stream->len + 130 + 2 <= STREAM_SIZE) {
+        stream->bytes[stream->len++] = 0xf0;
+        
+        for (int i = 0; i < 128; i++)
+            stream->bytes[stream->len++] = i;
+        
+        stream->bytes[stream->len++] = 0xf7;
+        stream->bytes[stream->len++] = 0xc0;
+        stream->bytes[stream->len++] = stream->messages & 0x7f;
+        stream->messages += 2;
+    }
+}
+
+/* the stream is parsed in USB sized pieces, like MIDI_READ delivers it */
+enum { PARSER_CHUNK = 61 };
+
+static void bench_parser(const char *name, midi_stream *stream) {
+    char bench_name[128];
+    midi_parser parser;
+    bench_run run;
+    uint64_t expected_bytes = 0;
+    
+    const char *modes[] = { "byte", "buffer", "buffer_batch" };
+    
+    for (int mode = 0; mode < 3; mode++) {
+        midi_parser_init(&parser, count_message, NULL);
+        
+        if (mode == 2)
+            midi_parser_set_batch_callback(&parser, count_message);
+        
+        parsed_messages = 0;
+        parsed_bytes = 0;
+        
+        bench_begin(&run);
+        
+        for (int round = 0; round < STREAM_ROUNDS; round++) {
+            for (int i = 0; i < stream->len; i += PARSER_CHUNK) {
+                int len = stream->len - i < PARSER_CHUNK ? stream->len - i : PARSER_CHUNK;
+                
+                if (mode == 0) {
+                    for (int j = 0; j < len; j++)
+                        midi_parser_parse(&parser, stream->bytes[i + j]);
+                }
+                else {
+                    midi_parser_parse_buffer(&parser, stream->bytes + i, len);
+                }
+            }
+        }
+        
+        bench_end(&run);
+        
+        /* a batch is a single call, so compare what came out byte by byte */
+        if (mode == 0)
+            expected_bytes = parsed_bytes;
+        
+        if (parsed_bytes != expected_bytes) {
+            printf("{\"bench\": \"midi_parser/%s/%s\", \"error\": \"parsed %llu bytes instead of %llu\"}\n",
+                name, modes[mode], (unsigned long long)parsed_bytes, (unsigned long long)expected_bytes);
+            continue;
+        }
+        
+        snprintf(bench_name, sizeof(bench_name), "midi_parser/%s/%s", name, modes[mode]);
+        report(bench_name, (uint64_t)stream->messages * STREAM_ROUNDS, &run);
+    }
+}
+
+/* MIDI clock in the middle of dense traffic: how long after the start of
+ * parsing a USB buffer the clock byte in it reaches the host. With the
+ * real time callback it's delivered when it's seen, otherwise when the
+ * batch it's part of is flushed
+ */
+enum { CLOCK_BUFFERS = 100000 };
+
+static uint64_t clock_parse_start;
+static uint64_t clock_latency;
+static int clock_seen;
+
+static void clock_realtime(uint8_t *buf, int len, void *user_data) {
+    clock_latency = now_ns() - clock_parse_start;
+    clock_seen++;
+}
+
+static void clock_batch(uint8_t *buf, int len, void *user_data) {
+    for (int i = 0; i < len; i++) {
+        if (buf[i] == 0xf8) {
+            clock_realtime(buf + i, 1, user_data);
+            break;
+        }
+    }
+    
+    parsed_bytes += len;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+static void bench_clock_latency(void) {
+    static uint64_t latencies[CLOCK_BUFFERS];
+    uint8_t buf[PARSER_CHUNK];
+    midi_parser parser;
+    
+    const char *modes[] = { "in_order", "realtime_callback" };
+    
+    for (int mode = 0; mode < 2; mode++) {
+        unsigned int seed = 1;
+        int in_sysex = 0;
+        
+        midi_parser_init(&parser, count_message, NULL);
+        midi_parser_set_batch_callback(&parser, clock_batch);
+        
+        if (mode == 1)
+            midi_parser_set_realtime_callback(&parser, clock_realtime);
+        
+        clock_seen = 0;
+        
+        for (int n = 0; n < CLOCK_BUFFERS; n++) {
+            seed = seed * 1103515245 + 12345;
+            int clock_at = (seed >> 16) % PARSER_CHUNK;
+            
+            /* control changes, with one buffer in eight being part of a sysex */
+            for (int i = 0; i < PARSER_CHUNK; i++) {
+                if (i == clock_at)
+                    buf[i] = 0xf8;
+                else if (in_sysex)
+                    buf[i] = (i == 0 && (n % 8) == 7) ? 0xf7 : i;
+                else
+                    buf[i] = (i % 3) == 0 ? 0xb0 : i;
+            }
+            
+            if ((n % 8) == 6) {
+                buf[clock_at == 0 ? 1 : 0] = 0xf0;
+                in_sysex = 1;
+            }
+            else if ((n % 8) == 7) {
+                in_sysex = 0;
+            }
+            
+            int seen = clock_seen;
+            
+            clock_parse_start = now_ns();
+            midi_parser_parse_buffer(&parser, buf, sizeof(buf));
+            
+            latencies[n] = clock_seen != seen ? clock_latency : 0;
+        }
+        
+        qsort(latencies, CLOCK_BUFFERS, sizeof(uint64_t), compare_u64);
+        
+        uint64_t sum = 0;
+        
+        for (int n = 0; n < CLOCK_BUFFERS; n++)
+            sum += latencies[n];
+        
+        uint64_t p50 = latencies[CLOCK_BUFFERS / 2];
+        uint64_t p99 = latencies[CLOCK_BUFFERS * 99 / 100];
+        
+        printf(
+            "{\"bench\": \"midi_parser/clock_latency/%s\", \"clocks\": %d, \"lost\": %d, "
+            "\"mean_ns\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"jitter_ns\": %llu}\n",
+            modes[mode],
+            clock_seen,
+            CLOCK_BUFFERS - clock_seen,
+            (double)sum / CLOCK_BUFFERS,
+            (unsigned long long)p50,
+            (unsigned long long)p99,
+            (unsigned long long)latencies[CLOCK_BUFFERS - 1],
+            (unsigned long long)(p99 - p50)
+        );
+    }
+}
+
+/* a librarian dump: one sysex much bigger than the parser's packet,
+ * streamed in fragments and put back together
+ */
+enum { SYSEX_DUMP_SIZE = 128 * 1024 };
+enum { SYSEX_DUMP_ROUNDS = 20 };
+
+typedef struct {
+    uint8_t *data;
+    int len;
+    int fragments;
+    int bad_flags;
+    int fragment_max;
+} sysex_reassembly;
+
+static void sysex_fragment(uint8_t *buf, int len, int flags, void *user_data) {
+    sysex_reassembly *r = (sysex_reassembly *)user_data;
+    
+    int expected = r->len == 0 ? MIDI_PARSER_SYSEX_START : MIDI_PARSER_SYSEX_CONTINUE;
+    
+    if (buf[len - 1] == 0xf7)
+        expected = (expected & MIDI_PARSER_SYSEX_START) | MIDI_PARSER_SYSEX_END;
+    
+    if (flags != expected)
+        r->bad_flags++;
+    
+    if (r->len + len <= SYSEX_DUMP_SIZE + 2)
+        memcpy(r->data + r->len, buf, len);
+    
+    r->len += len;
+    r->fragments++;
+    
+    if (len > r->fragment_max)
+        r->fragment_max = len;
+}
+
+static void bench_sysex_dump(void) {
+    static uint8_t dump[SYSEX_DUMP_SIZE + 2];
+    static uint8_t reassembled[SYSEX_DUMP_SIZE + 2];
+    char bench_name[128];
+    
+    const int fragment_sizes[] = { 1, 61, 256, MIDI_PARSER_PACKET_SIZE };
+    
+    dump[0] = 0xf0;
+    
+    for (int i = 1; i <= SYSEX_DUMP_SIZE; i++)
+        dump[i] = (i * 31) & 0x7f;
+    
+    dump[SYSEX_DUMP_SIZE + 1] = 0xf7;
+    
+    for (int f = 0; f < 4; f++) {
+        midi_parser parser;
+        sysex_reassembly r;
+        bench_run run;
+        int failed = 0;
+        
+        bench_begin(&run);
+        
+        for (int round = 0; round < SYSEX_DUMP_ROUNDS; round++) {
+            memset(&r, 0, sizeof(r));
+            r.data = reassembled;
+            
+            midi_parser_init(&parser, count_message, &r);
+            midi_parser_set_sysex_callback(&parser, sysex_fragment, fragment_sizes[f]);
+            
+            for (int i = 0; i < (int)sizeof(dump); i += PARSER_CHUNK) {
+                int len = (int)sizeof(dump) - i < PARSER_CHUNK ? (int)sizeof(dump) - i : PARSER_CHUNK;
+                midi_parser_parse_buffer(&parser, dump + i, len);
+            }
+            
+            if (r.len != (int)sizeof(dump) || r.bad_flags || r.fragment_max > fragment_sizes[f] ||
+                memcmp(r.data, dump, sizeof(dump)) != 0)
+                failed = 1;
+        }
+        
+        bench_end(&run);
+        
+        snprintf(bench_name, sizeof(bench_name), "midi_parser/sysex_dump/fragment_%d", fragment_sizes[f]);
+        
+        if (failed) {
+            printf("{\"bench\": \"%s\", \"error\": \"sysex not reassembled\"}\n", bench_name);
+            continue;
+        }
+        
+        report(bench_name, (uint64_t)sizeof(dump) * SYSEX_DUMP_ROUNDS, &run);
+    }
+}
+
+/* - driver
+ *
+ * a unit that isn't attached to any device: its endpoints are marked as
+ * cancelled so that nothing is ever submitted, and the benchmarks play
+ * the part of libusb by completing the queued buffers themselves. Its
+ * MIDI goes to a host backend that only counts it
+ */
+
+enum { DRIVER_ROUNDS = 1000000 };
+enum { DISPLAY_ROUNDS = 20000 };
+
+static uint64_t host_bytes;
+static uint64_t host_flushes;
+
+static midi_port *bench_host_open(
+    const char *name,
+    int index,
+    midi_backend_receive_callback *receive,
+    void *user_data
+) {
+    static int port;
+    return (midi_port *)&port;
+}
+
+static void bench_host_close(midi_port *port) {
+}
+
+static void bench_host_send(midi_port *port, uint64_t timestamp, const uint8_t *buf, int len) {
+    host_bytes += len;
+}
+
+static void bench_host_flush(midi_port *port) {
+    host_flushes++;
+}
+
+static const midi_backend bench_host = {
+    .name  = "bench",
+    .open  = bench_host_open,
+    .close = bench_host_close,
+    .send  = bench_host_send,
+    .flush = bench_host_flush,
+};
+
+static struct Maschine *bench_maschine(void) {
+    static struct maschine_driver driver;
+    static struct Maschine maschine;
+    
+    driver.config.host_midi = &bench_host;
+    driver.config.transfer_window = TRANSFER_WINDOW_DEFAULT;
+    
+    Maschine_InitState(&maschine, &driver, 0);
+    maschine.midi = bench_host.open("Bench", 0, Maschine_ReceiveHostMidi, &maschine);
+    
+    maschine.ep1_command_window.cancelled    = 1;
+    maschine.ep8_display_window.cancelled    = 1;
+    maschine.ep1_command_responses.cancelled = 1;
+    maschine.ep4_pad_reports.cancelled       = 1;
+    
+    return &maschine;
+}
+
+/* one of the two tapers of an encoder turned to phase, like the simulator does */
+static uint8_t erp_taper(int phase) {
+    phase %= 550;
+    
+    int value = phase < 275 ? phase - 7 : 543 - phase;
+    
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/* two tapers for each encoder */
+enum { ERP_REPORT_SIZE = ERP_COUNT * 2 };
+
+/* the table erp_decoder_decode looks positions up in must give what
+ * decode_erp computes, for every pair of taper values, at every offset
+ */
+static int check_erp_table(void) {
+    uint8_t report[ERP_REPORT_SIZE];
+    uint16_t positions[ERP_COUNT];
+    erp_decoder decoder;
+    int mismatches = 0;
+    int pairs = 0;
+    
+    erp_decoder_init(&decoder, midi_send, bench_maschine());
+    
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            unsigned int expected = decode_erp(a, b);
+            
+            for (int i = 0; i < ERP_REPORT_SIZE; i += 2) {
+                report[i]     = b;
+                report[i + 1] = a;
+            }
+            
+            erp_decoder_decode(report, positions);
+            
+            for (int i = 0; i < ERP_COUNT; i++)
+                mismatches += positions[i] != expected;
+            
+            pairs++;
+        }
+    }
+    
+    printf(
+        "{\"test\": \"erp/table_matches_decode_erp\", \"pairs\": %d, \"mismatches\": %d, \"ok\": %s}\n",
+        pairs,
+        mismatches,
+        mismatches == 0 ? "true" : "false"
+    );
+    
+    return mismatches == 0;
+}
+
+static void bench_erp(void) {
+    enum { ERP_REPORTS = 220 };
+    
+    static uint8_t reports[ERP_REPORTS][ERP_REPORT_SIZE];
+    static uint8_t tapers[2][ERP_REPORTS];
+    erp_decoder decoder;
+    bench_run run;
+    
+    /* every encoder turning clockwise, each at its own speed */
+    for (int r = 0; r < ERP_REPORTS; r++) {
+        for (int i = 0; i < ERP_REPORT_SIZE; i += 2) {
+            int phase = r * (i / 2 + 1);
+            
+            reports[r][i + 1] = erp_taper(phase);
+            reports[r][i]     = erp_taper(phase + 550 / 4);
+        }
+        
+        tapers[0][r] = reports[r][1];
+        tapers[1][r] = reports[r][0];
+    }
+    
+    unsigned int positions = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++)
+        positions += decode_erp(tapers[0][n % ERP_REPORTS], tapers[1][n % ERP_REPORTS]);
+    
+    bench_end(&run);
+    
+    if (positions == 0)
+        printf("{\"bench\": \"erp/decode_erp\", \"error\": \"no positions\"}\n");
+    else
+        report("erp/decode_erp", DRIVER_ROUNDS, &run);
+    
+    /* a whole report, every encoder computed against every encoder looked
+     * up: what the 128 kB table buys
+     */
+    positions = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++) {
+        const uint8_t *report = reports[n % ERP_REPORTS];
+        
+        for (int i = 0; i < ERP_REPORT_SIZE; i += 2)
+            positions += decode_erp(report[i + 1], report[i]);
+    }
+    
+    bench_end(&run);
+    
+    if (positions == 0)
+        printf("{\"bench\": \"erp/decode_report/decode_erp\", \"error\": \"no positions\"}\n");
+    else
+        report("erp/decode_report/decode_erp", DRIVER_ROUNDS, &run);
+    
+    uint16_t decoded[ERP_COUNT];
+    positions = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++) {
+        erp_decoder_decode(reports[n % ERP_REPORTS], decoded);
+        positions += decoded[n % ERP_COUNT];
+    }
+    
+    bench_end(&run);
+    
+    if (positions == 0)
+        printf("{\"bench\": \"erp/decode_report/table\", \"error\": \"no positions\"}\n");
+    else
+        report("erp/decode_report/table", DRIVER_ROUNDS, &run);
+    
+    host_bytes = 0;
+    erp_decoder_init(&decoder, midi_send, bench_maschine());
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++)
+        erp_decoder_process_report(&decoder, reports[n % ERP_REPORTS], ERP_REPORT_SIZE);
+    
+    bench_end(&run);
+    
+    if (host_bytes == 0)
+        printf("{\"bench\": \"erp/process_report\", \"error\": \"no messages sent\"}\n");
+    else
+        report("erp/process_report", DRIVER_ROUNDS, &run);
+}
+
+/* a command goes in and the oldest comes out, with a few always queued */
+static void bench_buffer_queue(void) {
+    enum { QUEUED = 8 };
+    
+    static struct Buffer commands[EP1_MIDI_QUEUE_SIZE];
+    static uint8_t storage[EP1_MIDI_QUEUE_SIZE][EP1_COMMAND_SLOT_SIZE];
+    struct BufferQueue queue;
+    uint8_t command[MASCHINE_LED_CMD_SIZE] = { EP1_CMD_DIMM_LEDS };
+    bench_run run;
+    
+    BufferQueue_Init(&queue, commands, &storage[0][0], EP1_MIDI_QUEUE_SIZE, EP1_COMMAND_SLOT_SIZE);
+    
+    for (int i = 0; i < QUEUED; i++)
+        BufferQueue_Add(&queue, command, sizeof(command));
+    
+    uint64_t peeked = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++) {
+        command[1] = n;
+        BufferQueue_Add(&queue, command, sizeof(command));
+        
+        peeked += BufferQueue_Peek(&queue)->buffer[1];
+        BufferQueue_Remove(&queue);
+    }
+    
+    bench_end(&run);
+    
+    if (BufferQueue_Count(&queue) != QUEUED || peeked == 0)
+        printf("{\"bench\": \"buffer_queue/add_peek_remove\", \"error\": \"queue out of step\"}\n");
+    else
+        report("buffer_queue/add_peek_remove", DRIVER_ROUNDS, &run);
+}
+
+/* frames where every row changed, and frames where only one did */
+static void bench_display(void) {
+    struct Maschine *maschine = bench_maschine();
+    enum MaschineDisplay d = MaschineDisplay_Left;
+    char bench_name[128];
+    
+    const int rows_changed[] = { display_height, 1 };
+    
+    for (int mode = 0; mode < 2; mode++) {
+        uint64_t transfers = 0;
+        bench_run run;
+        
+        bench_begin(&run);
+        
+        for (int n = 0; n < DISPLAY_ROUNDS; n++) {
+            for (int row = 0; row < rows_changed[mode]; row++)
+                display_row(maschine, d, (row + n) % display_height)[n % display_row_size] ^= 0xff;
+            
+            display_present(maschine, d);
+            
+            while (!BufferQueue_IsEmpty(&maschine->display_queue)) {
+                BufferQueue_Remove(&maschine->display_queue);
+                transfers++;
+            }
+        }
+        
+        bench_end(&run);
+        
+        snprintf(bench_name, sizeof(bench_name), "display/present/%d_rows_changed", rows_changed[mode]);
+        
+        if (transfers < DISPLAY_ROUNDS * 3) {
+            printf("{\"bench\": \"%s\", \"error\": \"frames not sent\"}\n", bench_name);
+            continue;
+        }
+        
+        report(bench_name, DISPLAY_ROUNDS, &run);
+    }
+}
+
+/* an LED toggled, its bank encoded and queued, then acknowledged */
+static void bench_leds(void) {
+    struct Maschine *maschine = bench_maschine();
+    MaschineLedState state;
+    bench_run run;
+    
+    MaschineLedState_Init(state);
+    
+    int changed = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++)
+        changed += MaschineLedState_SetLed(state, MaschineLed_Pad_1 + (n % 16), !((n / 16) & 1));
+    
+    bench_end(&run);
+    
+    if (changed != DRIVER_ROUNDS)
+        printf("{\"bench\": \"leds/set_led\", \"error\": \"LEDs did not change\"}\n");
+    else
+        report("leds/set_led", DRIVER_ROUNDS, &run);
+    
+    uint64_t sent = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++) {
+        led_engine_set_led(&maschine->leds, MaschineLed_Pad_1 + (n % 16), !((n / 16) & 1));
+        led_engine_flush(maschine);
+        
+        struct BufferQueue *queue = &maschine->command_queues[Ep1Class_Leds];
+        
+        while (!BufferQueue_IsEmpty(queue)) {
+            led_engine_transfer_done(maschine, BufferQueue_Peek(queue), 1);
+            BufferQueue_Remove(queue);
+            sent++;
+        }
+    }
+    
+    bench_end(&run);
+    
+    if (sent < DRIVER_ROUNDS)
+        printf("{\"bench\": \"leds/set_flush_send\", \"error\": \"banks not sent\"}\n");
+    else
+        report("leds/set_flush_send", DRIVER_ROUNDS, &run);
+}
+
+/* a changed config must change what the pads send: a press under the
+ * default note on threshold plays once the threshold is lowered, a held
+ * pad releases the note it played after the notes are moved, and a
+ * config that can't work is refused
+ */
+static uint8_t pad_check_last[3];
+static int pad_check_note_ons;
+
+static void pad_check_send(uint8_t *buf, int len, void *user_data) {
+    memcpy(pad_check_last, buf, 3);
+    pad_check_note_ons += (buf[0] & 0xf0) == 0x90;
+}
+
+static void pad_check_press(pad_engine *engine, uint16_t pressure) {
+    uint8_t report[PAD_ENGINE_PADS * 2];
+    
+    for (int i = 0; i < PAD_ENGINE_PADS; i++) {
+        uint16_t value = (i << 12) | (i == 0 ? pressure : 0);
+        
+        report[i * 2]     = value & 0xff;
+        report[i * 2 + 1] = value >> 8;
+    }
+    
+    pad_engine_process_report(engine, report, sizeof(report));
+}
+
+static int check_pad_config(void) {
+    pad_engine engine;
+    pad_engine_config config;
+    int failures = 0;
+    
+    pad_engine_init(&engine, pad_check_send, NULL);
+    pad_engine_default_config(&config);
+    pad_check_note_ons = 0;
+    
+    pad_check_press(&engine, 150);
+    pad_check_press(&engine, 0);
+    int default_note_ons = pad_check_note_ons;
+    
+    config.note_on_threshold  = 120;
+    config.note_off_threshold = 60;
+    
+    failures += pad_engine_set_config(&engine, &config) != 0;
+    
+    pad_check_press(&engine, 150);
+    int lowered_note_ons = pad_check_note_ons - default_note_ons;
+    
+    /* moved while the pad is down */
+    config.base_note = 48;
+    failures += pad_engine_set_config(&engine, &config) != 0;
+    
+    pad_check_press(&engine, 0);
+    int released_note = pad_check_last[0] == 0x89 ? pad_check_last[1] : -1;
+    
+    config.note_off_threshold = 200;
+    int refused = pad_engine_set_config(&engine, &config) == -1 && engine.config.note_off_threshold == 60;
+    
+    failures += default_note_ons != 0;
+    failures += lowered_note_ons != 1;
+    failures += released_note != 36;
+    failures += !refused;
+    
+    printf(
+        "{\"test\": \"pads/config_changes_note_on\", \"default_note_ons\": %d, \"lowered_note_ons\": %d, "
+        "\"released_note\": %d, \"invalid_refused\": %s, \"ok\": %s}\n",
+        default_note_ons,
+        lowered_note_ons,
+        released_note,
+        refused ? "true" : "false",
+        failures == 0 ? "true" : "false"
+    );
+    
+    return failures == 0;
+}
+
+/* the EP4 completion, pressing the pads one after the other: 8 reports
+ * rising, 8 holding and 8 releasing each
+ */
+static void bench_pad_reports(void) {
+    enum { PAD_REPORTS = 24 * 16 };
+    
+    static uint8_t reports[PAD_REPORTS][EP4_RESPONSE_TRANSFER_LENGTH];
+    struct Maschine *maschine = bench_maschine();
+    struct libusb_transfer transfer;
+    bench_run run;
+    
+    for (int r = 0; r < PAD_REPORTS; r++) {
+        int phase = r % 24;
+        int pad   = r / 24;
+        int pressure = phase < 8 ? (phase + 1) * 200 : phase < 16 ? 1600 : (23 - phase) * 200;
+        
+        for (int i = 0; i < 16; i++) {
+            uint16_t value = (i << 12) | (i == pad ? pressure : 0);
+            
+            reports[r][i * 2]     = value & 0xff;
+            reports[r][i * 2 + 1] = value >> 8;
+        }
+    }
+    
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.status        = LIBUSB_TRANSFER_COMPLETED;
+    transfer.actual_length = 32;
+    transfer.user_data     = maschine;
+    
+    host_bytes = 0;
+    host_flushes = 0;
+    
+    bench_begin(&run);
+    
+    for (int n = 0; n < DRIVER_ROUNDS; n++) {
+        transfer.buffer = reports[n % PAD_REPORTS];
+        maschine->ep4_pad_reports.queued = 1;
+        
+        ep4_pad_pressure_report_transfer_callback(&transfer);
+    }
+    
+    bench_end(&run);
+    
+    if (host_flushes == 0)
+        printf("{\"bench\": \"pads/report_callback\", \"error\": \"no messages sent\"}\n");
+    else
+        report("pads/report_callback", DRIVER_ROUNDS, &run);
+}
+
+/* - EP1 scheduling
+ *
+ * MIDI out latency while every LED changes on every tick, with a unit
+ * on a slow simulated bus. Runs in real time, a note every millisecond,
+ * with every command sent in the order it was queued, as before the
+ * priority classes, and with the classes, at the same windows
+ */
+
+enum { LOAD_NOTES = 1000 };
+
+/* what a driver stats histogram recorded between two snapshots */
+static void histogram_between(
+    const driver_stats_snapshot *before,
+    const driver_stats_snapshot *after,
+    enum driver_latency which,
+    driver_histogram_snapshot *histogram
+) {
+    const driver_histogram_snapshot *earlier = &before->latencies[which];
+    
+    *histogram = after->latencies[which];
+    histogram->count  -= earlier->count;
+    histogram->sum_ns -= earlier->sum_ns;
+    
+    for (int b = 0; b < DRIVER_HISTOGRAM_BUCKETS; b++)
+        histogram->buckets[b] -= earlier->buckets[b];
+}
+
+/* the simulated bus completes transfers on timeouts, waking up any later
+ * than the driver asks would show up as latency
+ */
+static void bench_wait(maschine_driver *driver, uint64_t wake) {
+    uint64_t now = now_ns();
+    
+    wait_readable(maschine_driver_fd(driver), wake > now ? wake - now : 0);
+    maschine_driver_process(driver);
+}
+
+static void bench_midi_out_under_led_load(void) {
+    const int windows[] = { 1, TRANSFER_WINDOW_DEFAULT };
+    const char *schedulers[] = { "fifo", "classes" };
+    char bench_name[128];
+    
+    for (int w = 0; w < 2; w++) {
+        for (int fifo = 1; fifo >= 0; fifo--) {
+            usb_simulator_config sim;
+            usb_simulator_default_config(&sim);
+            sim.bytes_per_second = 16000;
+            sim.pad_reports_hz   = 100;
+            usb_simulator_configure(&sim);
+            
+            maschine_driver_config config;
+            memset(&config, 0, sizeof(config));
+            config.transfer_window = windows[w];
+            
+            ep1_scheduler_fifo = fifo;
+            
+            maschine_driver *driver = maschine_driver_open(&config);
+            
+            driver_stats_snapshot before;
+            driver_stats_snapshot after;
+            maschine_driver_stats(driver, &before);
+            
+            usb_simulator_stats bus_before;
+            usb_simulator_stats bus_after;
+            usb_simulator_get_stats(0, &bus_before);
+            
+            uint64_t next_note = now_ns();
+            uint64_t drain_until = 0;
+            int notes = 0;
+            
+            while (notes < LOAD_NOTES || now_ns() < drain_until) {
+                uint64_t wake = maschine_driver_next_deadline(driver);
+                
+                if (notes < LOAD_NOTES && next_note < wake)
+                    wake = next_note;
+                
+                bench_wait(driver, wake);
+                
+                uint64_t now = now_ns();
+                int phase = (int)(now / TICK_INTERVAL_NS) & 1;
+                
+                for (int led = 0; led < MASCHINE_LED_BANK_SIZE * 2; led++)
+                    maschine_driver_set_led(driver, 0, led, (led & 1) == phase);
+                
+                if (notes < LOAD_NOTES && now >= next_note) {
+                    uint8_t note[3] = { notes & 1 ? 0x80 : 0x90, 60, 100 };
+                    
+                    maschine_driver_send_midi(driver, 0, note, sizeof(note));
+                    next_note += 1000000;
+                    
+                    if (++notes == LOAD_NOTES)
+                        drain_until = now + 100000000;
+                }
+            }
+            
+            maschine_driver_stats(driver, &after);
+            usb_simulator_get_stats(0, &bus_after);
+            maschine_driver_close(driver);
+            
+            ep1_scheduler_fifo = 0;
+            
+            driver_histogram_snapshot latency;
+            histogram_between(&before, &after, DRIVER_LATENCY_MIDI_OUT, &latency);
+            
+            snprintf(
+                bench_name,
+                sizeof(bench_name),
+                "ep1/midi_out_under_led_load/%s/window_%d",
+                schedulers[!fifo],
+                windows[w]
+            );
+            
+            printf(
+                "{\"bench\": \"%s\", \"writes\": %llu, "
+                "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+                "\"ep1_transfers\": %llu, \"ep1_bytes\": %llu}\n",
+                bench_name,
+                (unsigned long long)latency.count,
+                latency.count ? latency.sum_ns / latency.count / 1000.0 : 0.0,
+                driver_histogram_percentile(&latency, 0.5)  / 1000.0,
+                driver_histogram_percentile(&latency, 0.99) / 1000.0,
+                driver_histogram_percentile(&latency, 1.0)  / 1000.0,
+                (unsigned long long)(bus_after.ep1_out.transfers - bus_before.ep1_out.transfers),
+                (unsigned long long)(bus_after.ep1_out.bytes - bus_before.ep1_out.bytes)
+            );
+        }
+    }
+}
+
+/* - display frame rate
+ *
+ * how many frames a unit's two displays get through a simulated bus at
+ * its default 1 MB/s and 125 us per transfer, with the pads reporting
+ * on the same bus, redrawing every row of both displays whenever the
+ * previous frame is out. Runs in real time
+ */
+
+enum { DISPLAY_FPS_SECONDS = 2 };
+
+static void bench_display_frame_rate(void) {
+    const int windows[] = { 1, 2, 4, 8 };
+    char bench_name[128];
+    
+    for (int w = 0; w < 4; w++) {
+        usb_simulator_config sim;
+        usb_simulator_default_config(&sim);
+        usb_simulator_configure(&sim);
+        
+        maschine_driver_config config;
+        memset(&config, 0, sizeof(config));
+        config.transfer_window = windows[w];
+        
+        maschine_driver *driver = maschine_driver_open(&config);
+        
+        if (driver == NULL)
+            return;
+        
+        usb_simulator_stats bus;
+        uint64_t started = 0;
+        uint64_t until = 0;
+        uint64_t frames = 0;
+        uint64_t transfers = 0;
+        
+        /* what every byte of each display is set to, flipped every frame */
+        uint8_t phases[2] = { 0, 0 };
+        
+        /* the clock starts with the first frame, once the displays are
+         * initialized
+         */
+        while (started == 0 || now_ns() < until) {
+            for (int d = 0; d < 2; d++) {
+                enum MaschineDisplay display = d ? MaschineDisplay_Right : MaschineDisplay_Left;
+                struct Maschine *maschine = maschines_unit(driver, 0);
+                
+                if (maschine_driver_display_row(driver, 0, display, 0) == NULL)
+                    continue;
+                
+                /* a present while the last frame is out would only be
+                 * held until it's done, wait for it instead
+                 */
+                if (display_framebuffer_for(maschine, display)->slices_in_flight != 0)
+                    continue;
+                
+                phases[d] ^= 0xff;
+                
+                for (int row = 0; row < MASCHINE_DISPLAY_HEIGHT; row++)
+                    memset(maschine_driver_display_row(driver, 0, display, row), phases[d], MASCHINE_DISPLAY_ROW_SIZE);
+                
+                if (started == 0) {
+                    usb_simulator_get_stats(0, &bus);
+                    transfers = bus.ep8_out.transfers;
+                    started = now_ns();
+                    until = started + DISPLAY_FPS_SECONDS * 1000000000ull;
+                }
+                
+                maschine_driver_display_present(driver, 0, display);
+                frames++;
+            }
+            
+            bench_wait(driver, maschine_driver_next_deadline(driver));
+        }
+        
+        double elapsed = (now_ns() - started) / 1e9;
+        
+        usb_simulator_get_stats(0, &bus);
+        transfers = bus.ep8_out.transfers - transfers;
+        
+        maschine_driver_close(driver);
+        
+        snprintf(bench_name, sizeof(bench_name), "display/frame_rate/window_%d", windows[w]);
+        
+        if (frames == 0) {
+            printf("{\"bench\": \"%s\", \"error\": \"no frames sent\"}\n", bench_name);
+            continue;
+        }
+        
+        printf(
+            "{\"bench\": \"%s\", \"frames\": %llu, \"frames_per_second\": %.1f, \"transfers_per_frame\": %.1f}\n",
+            bench_name,
+            (unsigned long long)frames,
+            frames / elapsed / 2,
+            (double)transfers / frames
+        );
+    }
+}
+
+/* - devices
+ *
+ * what each attached unit costs the event loop, from 1 to 16 simulated
+ * units with their pads reporting at the simulator's default rate and
+ * every LED changing on every tick: the bytes of state, the time the
+ * 80 Hz tick spends on it, and the CPU time the loop's thread uses for
+ * it. Runs in real time
+ */
+
+enum { DEVICES_SECONDS = 1 };
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_devices(void) {
+    for (int devices = 1; devices <= USB_SIMULATOR_MAX_DEVICES; devices++) {
+        usb_simulator_config sim;
+        usb_simulator_default_config(&sim);
+        sim.devices = devices;
+        usb_simulator_configure(&sim);
+        
+        maschine_driver_config config;
+        memset(&config, 0, sizeof(config));
+        
+        maschine_driver *driver = maschine_driver_open(&config);
+        
+        if (driver == NULL)
+            return;
+        
+        /* every unit is attached by the first tick after the open */
+        uint64_t settle = now_ns() + 100000000;
+        
+        while (now_ns() < settle)
+            bench_wait(driver, maschine_driver_next_deadline(driver));
+        
+        struct EventLoopStats *stats = &driver->stats;
+        
+        unsigned int ticks = stats->ticks;
+        uint64_t tick_ns = stats->tick_ns_sum;
+        uint64_t cpu_ns = thread_cpu_ns();
+        uint64_t started = now_ns();
+        uint64_t until = started + DEVICES_SECONDS * 1000000000ull;
+        
+        while (now_ns() < until) {
+            int phase = (int)(now_ns() / TICK_INTERVAL_NS) & 1;
+            
+            for (int unit = 0; unit < devices; unit++) {
+                for (int led = 0; led < MASCHINE_LED_BANK_SIZE * 2; led++)
+                    maschine_driver_set_led(driver, unit, led, (led & 1) == phase);
+            }
+            
+            bench_wait(driver, maschine_driver_next_deadline(driver));
+        }
+        
+        double elapsed = (now_ns() - started) / 1e9;
+        
+        cpu_ns = thread_cpu_ns() - cpu_ns;
+        ticks = stats->ticks - ticks;
+        tick_ns = stats->tick_ns_sum - tick_ns;
+        
+        int attached = stats->devices;
+        
+        maschine_driver_close(driver);
+        
+        if (attached != devices || ticks == 0) {
+            printf(
+                "{\"bench\": \"devices/%d\", \"error\": \"%d units attached\"}\n",
+                devices,
+                attached
+            );
+            continue;
+        }
+        
+        printf(
+            "{\"bench\": \"devices/%d\", \"state_bytes\": %zu, \"state_bytes_per_device\": %zu, "
+            "\"tick_us\": %.1f, \"tick_us_per_device\": %.2f, \"cpu_percent\": %.2f, \"cpu_percent_per_device\": %.3f}\n",
+            devices,
+            sizeof(struct maschine_driver) + devices * sizeof(struct Maschine),
+            sizeof(struct Maschine),
+            tick_ns / ticks / 1000.0,
+            tick_ns / ticks / devices / 1000.0,
+            cpu_ns / elapsed / 1e7,
+            cpu_ns / elapsed / 1e7 / devices
+        );
+    }
+}
+
+/* - event thread
+ *
+ * how late the event loop runs its ticks while twice as many threads as
+ * there are CPUs spin, on a normal thread and on a real time one
+ */
+
+enum { JITTER_SECONDS = 2 };
+enum { JITTER_LOAD_THREADS_MAX = 256 };
+
+static _Atomic int load_running;
+
+static void *load_thread(void *user_data) {
+    volatile uint64_t spins = 0;
+    
+    while (atomic_load_explicit(&load_running, memory_order_relaxed))
+        spins++;
+    
+    return NULL;
+}
+
+static void bench_event_thread_jitter(void) {
+    static pthread_t load[JITTER_LOAD_THREADS_MAX];
+    
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int load_threads = cpus > 0 ? (int)cpus * 2 : 2;
+    
+    if (load_threads > JITTER_LOAD_THREADS_MAX)
+        load_threads = JITTER_LOAD_THREADS_MAX;
+    
+    atomic_store(&load_running, 1);
+    
+    for (int i = 0; i < load_threads; i++)
+        pthread_create(&load[i], NULL, load_thread, NULL);
+    
+    const int priorities[] = { 0, 50 };
+    
+    for (int p = 0; p < 2; p++) {
+        usb_simulator_config sim;
+        usb_simulator_default_config(&sim);
+        usb_simulator_configure(&sim);
+        
+        maschine_driver_config config;
+        memset(&config, 0, sizeof(config));
+        
+        maschine_driver *driver = maschine_driver_open(&config);
+        
+        driver_stats_snapshot before;
+        driver_stats_snapshot after;
+        maschine_driver_stats(driver, &before);
+        
+        if (maschine_driver_start_thread(driver, priorities[p]) != 0) {
+            printf("{\"bench\": \"event_thread/tick_late\", \"error\": \"no event thread\"}\n");
+            maschine_driver_close(driver);
+            continue;
+        }
+        
+        sleep(JITTER_SECONDS);
+        
+        int realtime = driver->thread_realtime;
+        
+        maschine_driver_stop_thread(driver);
+        maschine_driver_stats(driver, &after);
+        maschine_driver_close(driver);
+        
+        driver_histogram_snapshot late;
+        histogram_between(&before, &after, DRIVER_LATENCY_TICK_LATE, &late);
+        
+        printf(
+            "{\"bench\": \"event_thread/tick_late/%s\", \"load_threads\": %d, \"realtime\": %s, \"ticks\": %llu, "
+            "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+            priorities[p] ? "fifo" : "normal",
+            load_threads,
+            realtime ? "true" : "false",
+            (unsigned long long)late.count,
+            late.count ? late.sum_ns / late.count / 1000.0 : 0.0,
+            driver_histogram_percentile(&late, 0.5)  / 1000.0,
+            driver_histogram_percentile(&late, 0.99) / 1000.0,
+            driver_histogram_percentile(&late, 1.0)  / 1000.0
+        );
+    }
+    
+    atomic_store(&load_running, 0);
+    
+    for (int i = 0; i < load_threads; i++)
+        pthread_join(load[i], NULL);
+}
+
+/* - replay */
+
+static void bench_replay(const char *path) {
+    usb_simulator_config sim;
+    usb_simulator_default_config(&sim);
+    sim.devices = 0;
+    usb_simulator_configure(&sim);
+    
+    maschine_driver_config config;
+    memset(&config, 0, sizeof(config));
+    config.host_midi = &bench_host;
+    
+    maschine_driver *driver = maschine_driver_open(&config);
+    
+    if (driver == NULL)
+        return;
+    
+    bench_run run;
+    bench_begin(&run);
+    
+    int replayed = maschine_driver_replay(driver, path, 0);
+    
+    bench_end(&run);
+    maschine_driver_close(driver);
+    
+    if (replayed <= 0)
+        return;
+    
+    const char *name = strrchr(path, '/');
+    char bench_name[256];
+    
+    snprintf(bench_name, sizeof(bench_name), "replay/%s", name ? name + 1 : path);
+    report(bench_name, replayed, &run);
+}
+
+int main(int argc, char *argv[]) {
+    static midi_stream stream;
+    int failures = 0;
+    
+    driver_log_set_output(stderr);
+    
+    stream_dense_cc(&stream);
+    bench_parser("dense_cc", &stream);
+    
+    stream_running_status(&stream);
+    bench_parser("running_status", &stream);
+    
+    stream_sysex(&stream);
+    bench_parser("sysex", &stream);
+    
+    bench_clock_latency();
+    
+    bench_sysex_dump();
+    
+    if (!check_erp_table())
+        failures++;
+    
+    bench_erp();
+    bench_buffer_queue();
+    bench_display();
+    bench_leds();
+    
+    if (!check_pad_config())
+        failures++;
+    
+    bench_pad_reports();
+    
+    bench_midi_out_under_led_load();
+    bench_display_frame_rate();
+    bench_devices();
+    bench_event_thread_jitter();
+    
+    if (argc > 1)
+        bench_replay(argv[1]);
+    
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
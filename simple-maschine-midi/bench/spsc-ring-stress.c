@@ -0,0 +1,148 @@
+//
+//  spsc-ring-stress.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+/* two threads hammering one spsc_ring, meant to be built with the thread
+ * sanitizer:
+ *
+ *     cc -std=gnu11 -O1 -g -fsanitize=thread -I. -o spsc-ring-stress \
+ *         bench/spsc-ring-stress.c spsc-ring.c driver-log.c -lpthread
+ *
+ * the producer reserves and commits numbered items into a small ring,
+ * retrying whenever it's full, the consumer peeks and releases them,
+ * sleeping on the wakeup fd whenever it's empty. Every item must come out
+ * whole and in order, and every failed reserve must have been counted as
+ * an overflow. Exits with a failure otherwise, or if a wakeup got lost
+ */
+
+#include "../spsc-ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+
+enum { STRESS_ITEMS_DEFAULT = 4000000 };
+enum { STRESS_RING_SIZE = 64 };
+
+/* a consumer asleep this long with items still to come missed a wakeup */
+enum { STRESS_WAKEUP_TIMEOUT_MS = 5000 };
+
+typedef struct {
+    uint64_t sequence;
+    uint64_t check;
+} stress_item;
+
+static spsc_ring ring;
+static stress_item ring_storage[STRESS_RING_SIZE];
+
+static uint64_t items;
+static uint64_t producer_full;
+
+static void *producer_main(void *user_data) {
+    for (uint64_t sequence = 0; sequence < items; sequence++) {
+        stress_item *item;
+        
+        while ((item = spsc_ring_reserve(&ring)) == NULL) {
+            producer_full++;
+            sched_yield();
+        }
+        
+        item->sequence = sequence;
+        item->check = ~sequence;
+        
+        spsc_ring_commit(&ring);
+        
+        /* now and then let the consumer drain it, so that the empty ring
+         * wakeup is exercised as much as the full ring
+         */
+        if ((sequence & 0xfff) == 0)
+            sched_yield();
+    }
+    
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    items = argc > 1 ? strtoull(argv[1], NULL, 10) : STRESS_ITEMS_DEFAULT;
+    
+    if (spsc_ring_init(&ring, ring_storage, STRESS_RING_SIZE, sizeof(stress_item)) != 0)
+        return EXIT_FAILURE;
+    
+    pthread_t producer;
+    
+    if (pthread_create(&producer, NULL, producer_main, NULL) != 0) {
+        perror("cannot create the producer");
+        return EXIT_FAILURE;
+    }
+    
+    uint64_t expected = 0;
+    uint64_t out_of_order = 0;
+    uint64_t torn = 0;
+    uint64_t sleeps = 0;
+    int lost_wakeup = 0;
+    
+    while (expected < items) {
+        stress_item *item = spsc_ring_peek(&ring);
+        
+        if (item == NULL) {
+            struct pollfd pfd = { spsc_ring_wakeup_fd(&ring), POLLIN, 0 };
+            
+            /* as the event loop does: clear, look again, then sleep */
+            spsc_ring_clear_wakeup(&ring);
+            
+            if (spsc_ring_peek(&ring))
+                continue;
+            
+            sleeps++;
+            
+            if (poll(&pfd, 1, STRESS_WAKEUP_TIMEOUT_MS) == 0) {
+                lost_wakeup = 1;
+                break;
+            }
+            
+            continue;
+        }
+        
+        if (item->check != ~item->sequence)
+            torn++;
+        
+        if (item->sequence != expected)
+            out_of_order++;
+        
+        expected = item->sequence + 1;
+        spsc_ring_release(&ring);
+    }
+    
+    pthread_join(producer, NULL);
+    
+    unsigned int overflows = atomic_load(&ring.overflows);
+    int ok =
+        !lost_wakeup &&
+        out_of_order == 0 &&
+        torn == 0 &&
+        overflows == (unsigned int)producer_full;
+    
+    printf(
+        "{\"test\": \"spsc_ring/stress\", \"items\": %llu, \"received\": %llu, \"out_of_order\": %llu, "
+        "\"torn\": %llu, \"overflows\": %u, \"full_reserves\": %llu, \"sleeps\": %llu, \"lost_wakeup\": %s, \"ok\": %s}\n",
+        (unsigned long long)items,
+        (unsigned long long)expected,
+        (unsigned long long)out_of_order,
+        (unsigned long long)torn,
+        overflows,
+        (unsigned long long)producer_full,
+        (unsigned long long)sleeps,
+        lost_wakeup ? "true" : "false",
+        ok ? "true" : "false"
+    );
+    
+    spsc_ring_destroy(&ring);
+    
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
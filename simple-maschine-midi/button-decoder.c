@@ -0,0 +1,76 @@
+//
+//  button-decoder.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "button-decoder.h"
+#include "controls-map.h"
+
+#include <string.h>
+
+static const int button_count = sizeof(MaschineKeycodeMidi) / sizeof(MaschineKeycodeMidi[0]);
+
+void button_decoder_init(button_decoder *decoder, button_decoder_callback *callback, void *user_data) {
+    memset(decoder, 0, sizeof(button_decoder));
+    
+    decoder->channel = 1;
+    decoder->send = callback;
+    decoder->user_data = user_data;
+}
+
+static void button_send(button_decoder *decoder, int keycode, int pressed) {
+    const struct MaschineKeycodeMidiMapping *mapping = &MaschineKeycodeMidi[keycode];
+    uint8_t message[3];
+    
+    switch (mapping->type) {
+        case MaschineKeycodeMidi_None:
+            return;
+            
+        case MaschineKeycodeMidi_Note:
+            message[0] = (pressed ? 0x90 : 0x80) | decoder->channel;
+            message[1] = mapping->number;
+            message[2] = pressed ? 127 : 0;
+            break;
+            
+        case MaschineKeycodeMidi_CC:
+            message[0] = 0xb0 | decoder->channel;
+            message[1] = mapping->number;
+            message[2] = pressed ? 127 : 0;
+            break;
+    }
+    
+    decoder->send(message, 3, decoder->user_data);
+}
+
+int button_decoder_process_report(button_decoder *decoder, const uint8_t *report, int len) {
+    uint64_t pressed = 0;
+    int sent = 0;
+    
+    /* a truncated report would read as every button released */
+    if (len < (button_count + 7) / 8)
+        return 0;
+    
+    if (len > 8)
+        len = 8;
+    
+    for (int i = 0; i < len; i++)
+        pressed |= (uint64_t)report[i] << (i * 8);
+    
+    pressed &= (1ull << button_count) - 1;
+    
+    uint64_t changed = pressed ^ decoder->pressed;
+    decoder->pressed = pressed;
+    
+    while (changed) {
+        int keycode = __builtin_ctzll(changed);
+        changed &= changed - 1;
+        
+        button_send(decoder, keycode, (pressed >> keycode) & 1);
+        sent++;
+    }
+    
+    return sent;
+}
@@ -0,0 +1,34 @@
+//
+//  button-decoder.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef button_decoder_h
+#define button_decoder_h
+
+#include <stdint.h>
+
+typedef void (button_decoder_callback)(uint8_t *buf, int len, void *user_data);
+
+/* the buttons are kept as a bitset, bit n being MaschineKeycodes n */
+typedef struct {
+    uint64_t pressed;
+    uint8_t channel;
+    
+    button_decoder_callback *send;
+    void *user_data;
+} button_decoder;
+
+void button_decoder_init(button_decoder *decoder, button_decoder_callback *callback, void *user_data);
+
+/* compares an EP1_CMD_READ_IO report (without the command byte) with the
+ * previous one, and sends the MaschineKeycodeMidi mapping of every button
+ * that was pressed or released. A report too short to hold every button
+ * is ignored. returns how many messages were sent
+ */
+int button_decoder_process_report(button_decoder *decoder, const uint8_t *report, int len);
+
+#endif /* button_decoder_h */
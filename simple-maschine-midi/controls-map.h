@@ -9,6 +9,8 @@
 #ifndef controls_map_h
 #define controls_map_h
 
+#include <stdint.h>
+
 enum MaschineKeycodes {
     MaschineKeycode_Mute,
     MaschineKeycode_Solo,
@@ -132,7 +134,7 @@ enum MaschineLeds {
     MaschineLed_BacklightDisplay,
 };
 
-static const char * MaschineKeycodeNames[] = {
+static const char * const MaschineKeycodeNames[] = {
     "mute",
     "solo",
     "select",
@@ -183,4 +185,69 @@ static const char * MaschineKeycodeNames[] = {
     "play",
 };
 
+enum MaschineKeycodeMidiType {
+    MaschineKeycodeMidi_None,
+    MaschineKeycodeMidi_Note,
+    MaschineKeycodeMidi_CC,
+};
+
+struct MaschineKeycodeMidiMapping {
+    enum MaschineKeycodeMidiType type;
+    uint8_t number;
+};
+
+/* notes are sent with velocity 127 on press and as note off on release,
+ * CCs as 127 on press and 0 on release
+ */
+static const struct MaschineKeycodeMidiMapping MaschineKeycodeMidi[] = {
+    { MaschineKeycodeMidi_Note,  0 }, // mute
+    { MaschineKeycodeMidi_Note,  1 }, // solo
+    { MaschineKeycodeMidi_Note,  2 }, // select
+    { MaschineKeycodeMidi_Note,  3 }, // duplicate
+    { MaschineKeycodeMidi_Note,  4 }, // navigate
+    { MaschineKeycodeMidi_Note,  5 }, // pad
+    { MaschineKeycodeMidi_Note,  6 }, // pattern
+    { MaschineKeycodeMidi_Note,  7 }, // scene
+    
+    { MaschineKeycodeMidi_None,  0 }, // unused
+    
+    { MaschineKeycodeMidi_CC,  113 }, // rec
+    { MaschineKeycodeMidi_CC,  114 }, // erase
+    { MaschineKeycodeMidi_Note,  8 }, // shift
+    { MaschineKeycodeMidi_Note,  9 }, // grid
+    { MaschineKeycodeMidi_CC,  112 }, // >
+    { MaschineKeycodeMidi_CC,  111 }, // <
+    { MaschineKeycodeMidi_CC,  110 }, // restart
+    
+    { MaschineKeycodeMidi_Note, 14 }, // E
+    { MaschineKeycodeMidi_Note, 15 }, // F
+    { MaschineKeycodeMidi_Note, 16 }, // G
+    { MaschineKeycodeMidi_Note, 17 }, // H
+    { MaschineKeycodeMidi_Note, 13 }, // D
+    { MaschineKeycodeMidi_Note, 12 }, // C
+    { MaschineKeycodeMidi_Note, 11 }, // B
+    { MaschineKeycodeMidi_Note, 10 }, // A
+    
+    { MaschineKeycodeMidi_Note, 18 }, // control
+    { MaschineKeycodeMidi_Note, 19 }, // browse
+    { MaschineKeycodeMidi_Note, 20 }, // <
+    { MaschineKeycodeMidi_Note, 21 }, // snap
+    { MaschineKeycodeMidi_Note, 22 }, // autowrite
+    { MaschineKeycodeMidi_Note, 23 }, // >
+    { MaschineKeycodeMidi_Note, 24 }, // sampling
+    { MaschineKeycodeMidi_Note, 25 }, // step
+    
+    { MaschineKeycodeMidi_Note, 26 }, // soft1
+    { MaschineKeycodeMidi_Note, 27 }, // soft2
+    { MaschineKeycodeMidi_Note, 28 }, // soft3
+    { MaschineKeycodeMidi_Note, 29 }, // soft4
+    { MaschineKeycodeMidi_Note, 30 }, // soft5
+    { MaschineKeycodeMidi_Note, 31 }, // soft6
+    { MaschineKeycodeMidi_Note, 32 }, // soft7
+    { MaschineKeycodeMidi_Note, 33 }, // soft8
+    
+    { MaschineKeycodeMidi_Note, 34 }, // note repeat
+    { MaschineKeycodeMidi_CC,  115 }, // play
+};
+
 #endif /* controls_map_h */
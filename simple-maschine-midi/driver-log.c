@@ -0,0 +1,142 @@
+//
+//  driver-log.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "driver-log.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* a bounded multi producer ring: every slot has a sequence number telling
+ * whose turn it is. A producer claims the slot at head when its sequence
+ * equals head, and publishes it by setting it to head + 1. The consumer
+ * frees it for the next lap by setting it to tail + DRIVER_LOG_SLOTS
+ */
+
+typedef struct {
+    _Atomic unsigned int sequence;
+    char text[DRIVER_LOG_MESSAGE_SIZE];
+} driver_log_slot;
+
+static struct {
+    _Atomic int deferred;
+    
+    /* NULL for stdout, which isn't a constant */
+    FILE *output;
+    
+    _Atomic unsigned int head;
+    uint8_t pad0[60];
+    
+    unsigned int tail;
+    uint8_t pad1[60];
+    
+    _Atomic unsigned int dropped;
+    
+    driver_log_slot slots[DRIVER_LOG_SLOTS];
+} driver_log_ring;
+
+static driver_log_slot *driver_log_claim(void) {
+    unsigned int head = atomic_load_explicit(&driver_log_ring.head, memory_order_relaxed);
+    
+    while (1) {
+        driver_log_slot *slot = &driver_log_ring.slots[head % DRIVER_LOG_SLOTS];
+        unsigned int sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int lap = (int)(sequence - head);
+        
+        if (lap == 0) {
+            if (atomic_compare_exchange_weak_explicit(&driver_log_ring.head, &head, head + 1, memory_order_relaxed, memory_order_relaxed))
+                return slot;
+        }
+        
+        /* the consumer hasn't freed it yet, the ring is full */
+        else if (lap < 0) {
+            return NULL;
+        }
+        
+        else {
+            head = atomic_load_explicit(&driver_log_ring.head, memory_order_relaxed);
+        }
+    }
+}
+
+void driver_log(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    
+    if (!atomic_load_explicit(&driver_log_ring.deferred, memory_order_acquire)) {
+        vfprintf(driver_log_ring.output ? driver_log_ring.output : stdout, format, args);
+        va_end(args);
+        return;
+    }
+    
+    driver_log_slot *slot = driver_log_claim();
+    
+    if (slot == NULL) {
+        atomic_fetch_add_explicit(&driver_log_ring.dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+    
+    /* the slot's sequence is its position in the ring, published once
+     * the text is in
+     */
+    unsigned int position = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    
+    vsnprintf(slot->text, DRIVER_LOG_MESSAGE_SIZE, format, args);
+    va_end(args);
+    
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+}
+
+void driver_log_defer(int deferred) {
+    if (deferred && !atomic_load_explicit(&driver_log_ring.deferred, memory_order_relaxed)) {
+        atomic_store_explicit(&driver_log_ring.head, 0, memory_order_relaxed);
+        driver_log_ring.tail = 0;
+        
+        for (unsigned int i = 0; i < DRIVER_LOG_SLOTS; i++)
+            atomic_store_explicit(&driver_log_ring.slots[i].sequence, i, memory_order_relaxed);
+    }
+    
+    atomic_store_explicit(&driver_log_ring.deferred, deferred, memory_order_release);
+}
+
+void driver_log_set_output(FILE *out) {
+    driver_log_ring.output = out;
+}
+
+int driver_log_drain(FILE *out) {
+    int printed = 0;
+    
+    if (out == NULL)
+        out = driver_log_ring.output ? driver_log_ring.output : stdout;
+    
+    while (1) {
+        unsigned int tail = driver_log_ring.tail;
+        driver_log_slot *slot = &driver_log_ring.slots[tail % DRIVER_LOG_SLOTS];
+        unsigned int sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        
+        if (sequence != tail + 1)
+            break;
+        
+        fputs(slot->text, out);
+        printed++;
+        
+        driver_log_ring.tail = tail + 1;
+        atomic_store_explicit(&slot->sequence, tail + DRIVER_LOG_SLOTS, memory_order_release);
+    }
+    
+    unsigned int dropped = atomic_exchange_explicit(&driver_log_ring.dropped, 0, memory_order_relaxed);
+    
+    if (dropped)
+        fprintf(out, "%u log messages dropped\n", dropped);
+    
+    if (printed || dropped)
+        fflush(out);
+    
+    return printed;
+}
@@ -0,0 +1,41 @@
+//
+//  driver-log.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef driver_log_h
+#define driver_log_h
+
+#include <stdio.h>
+
+/* diagnostics from the driver. They are printed straight away, on stdout
+ * unless driver_log_set_output says otherwise, until driver_log_defer(1):
+ * from then on they are formatted into a lock free ring, and only printed
+ * when driver_log_drain is called, so that a real time thread never
+ * blocks on the terminal.
+ *
+ * any thread can log. A message that doesn't fit the ring is dropped and
+ * counted, the count is printed with the next drain
+ */
+
+enum { DRIVER_LOG_MESSAGE_SIZE = 256 };
+enum { DRIVER_LOG_SLOTS        = 256 };
+
+void driver_log(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+void driver_log_defer(int deferred);
+
+/* where the messages go, for example stderr when stdout carries results.
+ * To be called before anything logs
+ */
+void driver_log_set_output(FILE *out);
+
+/* from a single thread, one that is allowed to block. out is NULL for the
+ * log output. Returns how many messages were printed
+ */
+int driver_log_drain(FILE *out);
+
+#endif /* driver_log_h */
@@ -0,0 +1,186 @@
+//
+//  driver-stats.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "driver-stats.h"
+
+#include <string.h>
+#include <time.h>
+
+static const char *latency_names[DRIVER_LATENCY_COUNT] = {
+    [DRIVER_LATENCY_PADS]      = "pads",
+    [DRIVER_LATENCY_BUTTONS]   = "buttons",
+    [DRIVER_LATENCY_ERPS]      = "erps",
+    [DRIVER_LATENCY_DIN_MIDI]  = "din midi",
+    [DRIVER_LATENCY_MIDI_OUT]  = "midi out",
+    [DRIVER_LATENCY_EP1_OUT]   = "ep1 out",
+    [DRIVER_LATENCY_EP1_IN]    = "ep1 in",
+    [DRIVER_LATENCY_EP4_IN]    = "ep4 in",
+    [DRIVER_LATENCY_EP8_OUT]   = "ep8 out",
+    [DRIVER_LATENCY_TICK_LATE] = "tick late",
+};
+
+static uint64_t driver_stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void driver_stats_init(driver_stats *stats) {
+    memset(stats, 0, sizeof(driver_stats));
+    stats->started_at = driver_stats_now_ns();
+}
+
+/* - histograms */
+
+static int bucket_for(uint64_t ns) {
+    if (ns < 4)
+        return (int)ns;
+    
+    int msb = 63 - __builtin_clzll(ns);
+    int bucket = (msb - 1) * 4 + (int)((ns >> (msb - 2)) & 3);
+    
+    return bucket < DRIVER_HISTOGRAM_BUCKETS ? bucket : DRIVER_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t bucket_upper_bound(int bucket) {
+    if (bucket < 4)
+        return (uint64_t)bucket + 1;
+    
+    int msb = bucket / 4 + 1;
+    uint64_t width = 1ull << (msb - 2);
+    
+    return (4 + (uint64_t)(bucket % 4)) * width + width;
+}
+
+static void atomic_store_max(_Atomic uint64_t *max, uint64_t value) {
+    uint64_t current = atomic_load_explicit(max, memory_order_relaxed);
+    
+    while (value > current) {
+        if (atomic_compare_exchange_weak_explicit(max, &current, value, memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+void driver_stats_record(driver_stats *stats, enum driver_latency latency, uint64_t ns) {
+    driver_histogram *histogram = &stats->latencies[latency];
+    
+    atomic_fetch_add_explicit(&histogram->buckets[bucket_for(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum_ns, ns, memory_order_relaxed);
+    atomic_store_max(&histogram->max_ns, ns);
+}
+
+uint64_t driver_histogram_percentile(const driver_histogram_snapshot *histogram, double p) {
+    if (histogram->count == 0)
+        return 0;
+    
+    uint64_t rank = (uint64_t)(p * histogram->count);
+    uint64_t seen = 0;
+    
+    if (rank >= histogram->count)
+        rank = histogram->count - 1;
+    
+    for (int i = 0; i < DRIVER_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        
+        if (seen > rank) {
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < histogram->max_ns ? bound : histogram->max_ns;
+        }
+    }
+    
+    return histogram->max_ns;
+}
+
+const char *driver_latency_name(enum driver_latency latency) {
+    return latency_names[latency];
+}
+
+/* - queues and counters */
+
+void driver_stats_queue_depth(driver_stats *stats, enum driver_queue queue, unsigned int depth) {
+    _Atomic unsigned int *high_water = &stats->queue_high_water[queue];
+    unsigned int current = atomic_load_explicit(high_water, memory_order_relaxed);
+    
+    while (depth > current) {
+        if (atomic_compare_exchange_weak_explicit(high_water, &current, depth, memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+void driver_stats_count(driver_stats *stats, enum driver_counter counter) {
+    atomic_fetch_add_explicit(&stats->counters[counter], 1, memory_order_relaxed);
+}
+
+/* - snapshots */
+
+void driver_stats_snapshot_take(driver_stats *stats, driver_stats_snapshot *snapshot) {
+    snapshot->started_at = stats->started_at;
+    snapshot->taken_at   = driver_stats_now_ns();
+    
+    for (int i = 0; i < DRIVER_LATENCY_COUNT; i++) {
+        driver_histogram *from = &stats->latencies[i];
+        driver_histogram_snapshot *to = &snapshot->latencies[i];
+        
+        to->sum_ns = atomic_load_explicit(&from->sum_ns, memory_order_relaxed);
+        to->max_ns = atomic_load_explicit(&from->max_ns, memory_order_relaxed);
+        
+        /* counted from the buckets, so that the percentiles stay
+         * consistent while the writer is halfway through a record
+         */
+        to->count = 0;
+        
+        for (int b = 0; b < DRIVER_HISTOGRAM_BUCKETS; b++) {
+            to->buckets[b] = atomic_load_explicit(&from->buckets[b], memory_order_relaxed);
+            to->count += to->buckets[b];
+        }
+    }
+    
+    for (int i = 0; i < DRIVER_QUEUE_COUNT; i++)
+        snapshot->queue_high_water[i] = atomic_load_explicit(&stats->queue_high_water[i], memory_order_relaxed);
+    
+    for (int i = 0; i < DRIVER_COUNTER_COUNT; i++)
+        snapshot->counters[i] = atomic_load_explicit(&stats->counters[i], memory_order_relaxed);
+}
+
+void driver_stats_dump(FILE *out, const driver_stats_snapshot *snapshot) {
+    fprintf(
+        out,
+        "driver stats after %.1f s\n"
+        "  %-10s %10s %9s %9s %9s %9s %9s\n",
+        (snapshot->taken_at - snapshot->started_at) / 1e9,
+        "latency", "count", "avg us", "p50 us", "p99 us", "p99.9 us", "max us"
+    );
+    
+    for (int i = 0; i < DRIVER_LATENCY_COUNT; i++) {
+        const driver_histogram_snapshot *h = &snapshot->latencies[i];
+        
+        fprintf(
+            out,
+            "  %-10s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+            latency_names[i],
+            (unsigned long long)h->count,
+            h->count ? h->sum_ns / h->count / 1000.0 : 0.0,
+            driver_histogram_percentile(h, 0.5)   / 1000.0,
+            driver_histogram_percentile(h, 0.99)  / 1000.0,
+            driver_histogram_percentile(h, 0.999) / 1000.0,
+            h->max_ns / 1000.0
+        );
+    }
+    
+    fprintf(
+        out,
+        "  queue high water: commands %u  display %u\n"
+        "  submit failures: %llu  resubmit failures: %llu  queue overflows: %llu\n",
+        snapshot->queue_high_water[DRIVER_QUEUE_COMMANDS],
+        snapshot->queue_high_water[DRIVER_QUEUE_DISPLAY],
+        (unsigned long long)snapshot->counters[DRIVER_COUNTER_SUBMIT_FAILURES],
+        (unsigned long long)snapshot->counters[DRIVER_COUNTER_RESUBMIT_FAILURES],
+        (unsigned long long)snapshot->counters[DRIVER_COUNTER_QUEUE_OVERFLOWS]
+    );
+}
@@ -0,0 +1,118 @@
+//
+//  driver-stats.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef driver_stats_h
+#define driver_stats_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+/* counters and latency histograms that are always on, cheap enough to be
+ * updated from the USB callbacks. Each driver keeps its own. Every update
+ * is a relaxed atomic, so a snapshot can be taken from any thread while
+ * the driver runs.
+ *
+ * values only ever grow: to look at a time window, take two snapshots
+ * and compare them.
+ */
+
+enum driver_latency {
+    /* from the USB completion to the MIDI being handed to the host */
+    DRIVER_LATENCY_PADS,
+    DRIVER_LATENCY_BUTTONS,
+    DRIVER_LATENCY_ERPS,
+    DRIVER_LATENCY_DIN_MIDI,
+    
+    /* from the host MIDI reaching the driver to its EP1 write completing */
+    DRIVER_LATENCY_MIDI_OUT,
+    
+    /* from the submission of a transfer to its completion */
+    DRIVER_LATENCY_EP1_OUT,
+    DRIVER_LATENCY_EP1_IN,
+    DRIVER_LATENCY_EP4_IN,
+    DRIVER_LATENCY_EP8_OUT,
+    
+    /* from when the event loop was due for its tick to when it ran it */
+    DRIVER_LATENCY_TICK_LATE,
+    
+    DRIVER_LATENCY_COUNT
+};
+
+enum driver_queue {
+    DRIVER_QUEUE_COMMANDS,
+    DRIVER_QUEUE_DISPLAY,
+    
+    DRIVER_QUEUE_COUNT
+};
+
+enum driver_counter {
+    DRIVER_COUNTER_SUBMIT_FAILURES,
+    DRIVER_COUNTER_RESUBMIT_FAILURES,
+    DRIVER_COUNTER_QUEUE_OVERFLOWS,
+    
+    DRIVER_COUNTER_COUNT
+};
+
+/* four buckets for each power of two of nanoseconds, so a bucket is at
+ * most 25% wider than its lower bound. The last one takes everything
+ * from about 8.6 seconds up
+ */
+enum { DRIVER_HISTOGRAM_BUCKETS = 128 };
+
+typedef struct {
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[DRIVER_HISTOGRAM_BUCKETS];
+} driver_histogram;
+
+typedef struct {
+    /* monotonic, in nanoseconds */
+    uint64_t started_at;
+    
+    driver_histogram latencies[DRIVER_LATENCY_COUNT];
+    _Atomic unsigned int queue_high_water[DRIVER_QUEUE_COUNT];
+    _Atomic uint64_t counters[DRIVER_COUNTER_COUNT];
+} driver_stats;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[DRIVER_HISTOGRAM_BUCKETS];
+} driver_histogram_snapshot;
+
+typedef struct {
+    /* monotonic, in nanoseconds */
+    uint64_t started_at;
+    uint64_t taken_at;
+    
+    driver_histogram_snapshot latencies[DRIVER_LATENCY_COUNT];
+    unsigned int queue_high_water[DRIVER_QUEUE_COUNT];
+    uint64_t counters[DRIVER_COUNTER_COUNT];
+} driver_stats_snapshot;
+
+/* clears everything and starts the clock */
+void driver_stats_init(driver_stats *stats);
+
+void driver_stats_record(driver_stats *stats, enum driver_latency latency, uint64_t ns);
+void driver_stats_queue_depth(driver_stats *stats, enum driver_queue queue, unsigned int depth);
+void driver_stats_count(driver_stats *stats, enum driver_counter counter);
+
+void driver_stats_snapshot_take(driver_stats *stats, driver_stats_snapshot *snapshot);
+
+/* p between 0 and 1. The answer is the upper bound of the bucket holding
+ * the percentile, never more than the largest value recorded
+ */
+uint64_t driver_histogram_percentile(const driver_histogram_snapshot *histogram, double p);
+
+const char *driver_latency_name(enum driver_latency latency);
+
+void driver_stats_dump(FILE *out, const driver_stats_snapshot *snapshot);
+
+#endif /* driver_stats_h */
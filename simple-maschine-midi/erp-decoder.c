@@ -0,0 +1,181 @@
+//
+//  erp-decoder.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "erp-decoder.h"
+#include <stdlib.h>
+#include <string.h>
+
+unsigned int decode_erp(uint8_t a, uint8_t b)
+{
+    /* some of these devices have endless rotation potentiometers
+     * built in which use two tapers, 90 degrees phase shifted.
+     * this algorithm decodes them to one single value, ranging
+     * from 0 to 999 */
+    
+    static const int HIGH_PEAK = 268;
+    static const int LOW_PEAK  = -7;
+
+    static const int range     = HIGH_PEAK - LOW_PEAK;
+    
+    static const int DEG90     = (range / 2);
+    static const int DEG180    = (range);
+    static const int DEG270    = (DEG90 + DEG180);
+    static const int DEG360    = (DEG180 * 2);
+    
+    int weight_a, weight_b;
+    int pos_a, pos_b;
+    int ret;
+    int mid_value = (HIGH_PEAK + LOW_PEAK) / 2;
+
+    weight_b = abs(mid_value - a) - (range / 2 - 100) / 2;
+
+    if (weight_b < 0)
+        weight_b = 0;
+
+    if (weight_b > 100)
+        weight_b = 100;
+
+    weight_a = 100 - weight_b;
+
+    if (a < mid_value) {
+        /* 0..90 and 270..360 degrees */
+        pos_b = b - LOW_PEAK + DEG270;
+        if (pos_b >= DEG360)
+            pos_b -= DEG360;
+    } else
+        /* 90..270 degrees */
+        pos_b = HIGH_PEAK - b + DEG90;
+
+
+    if (b > mid_value)
+        /* 0..180 degrees */
+        pos_a = a - LOW_PEAK;
+    else
+        /* 180..360 degrees */
+        pos_a = HIGH_PEAK - a + DEG180;
+
+    /* interpolate both slider values, depending on weight factors */
+    /* 0..99 x DEG360 */
+    ret = pos_a * weight_a + pos_b * weight_b;
+
+    /* normalize to 0..999 */
+    ret *= 10;
+    ret /= DEG360;
+
+    if (ret < 0)
+        ret += 1000;
+
+    if (ret >= 1000)
+        ret -= 1000;
+
+    return ret;
+}
+
+/* (a, b) byte offsets of each encoder in the report */
+static const uint8_t erp_offsets[ERP_COUNT][2] = {
+    { 21, 20 }, { 15, 14 }, {  9,  8 }, {  3,  2 },
+    { 19, 18 }, { 13, 12 }, {  7,  6 }, {  1,  0 },
+    { 17, 16 },
+    { 11, 10 },
+    {  5,  4 },
+};
+
+static const int ERP_REPORT_SIZE = 22;
+
+/* decode_erp for every (a << 8 | b) */
+static uint16_t erp_table[256 * 256];
+static int erp_table_ready = 0;
+
+static void erp_table_init(void) {
+    if (erp_table_ready)
+        return;
+    
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            erp_table[(a << 8) | b] = decode_erp(a, b);
+        }
+    }
+    
+    erp_table_ready = 1;
+}
+
+void erp_decoder_init(erp_decoder *decoder, erp_decoder_callback *callback, void *user_data) {
+    memset(decoder, 0, sizeof(erp_decoder));
+    
+    decoder->config.channel        = 0;
+    decoder->config.first_cc       = 16;
+    decoder->config.steps_per_tick = 10;
+    
+    decoder->send = callback;
+    decoder->user_data = user_data;
+    
+    erp_table_init();
+}
+
+void erp_decoder_decode(const uint8_t *report, uint16_t positions[ERP_COUNT]) {
+    for (int i = 0; i < ERP_COUNT; i++) {
+        uint8_t a = report[erp_offsets[i][0]];
+        uint8_t b = report[erp_offsets[i][1]];
+        
+        positions[i] = erp_table[(a << 8) | b];
+    }
+}
+
+int erp_decoder_process_report(erp_decoder *decoder, const uint8_t *report, int len) {
+    erp_decoder_config *config = &decoder->config;
+    
+    uint16_t positions[ERP_COUNT];
+    uint8_t message[3];
+    int sent = 0;
+    
+    if (len < ERP_REPORT_SIZE)
+        return 0;
+    
+    erp_decoder_decode(report, positions);
+    
+    if (!decoder->has_positions) {
+        memcpy(decoder->positions, positions, sizeof(positions));
+        decoder->has_positions = 1;
+        return 0;
+    }
+    
+    for (int i = 0; i < ERP_COUNT; i++) {
+        int delta = positions[i] - decoder->positions[i];
+        
+        /* take the short way around the end of the range */
+        if (delta >= ERP_RANGE / 2)
+            delta -= ERP_RANGE;
+        
+        if (delta < -ERP_RANGE / 2)
+            delta += ERP_RANGE;
+        
+        decoder->positions[i] = positions[i];
+        decoder->accumulated[i] += delta;
+        
+        int steps = decoder->accumulated[i] / config->steps_per_tick;
+        
+        if (steps == 0)
+            continue;
+        
+        decoder->accumulated[i] -= steps * config->steps_per_tick;
+        
+        if (steps > 63)
+            steps = 63;
+        
+        if (steps < -63)
+            steps = -63;
+        
+        message[0] = 0xb0 | config->channel;
+        message[1] = config->first_cc + i;
+        message[2] = 64 + steps;
+        decoder->send(message, 3, decoder->user_data);
+        sent++;
+    }
+    
+    return sent;
+}
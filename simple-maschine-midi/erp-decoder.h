@@ -0,0 +1,58 @@
+//
+//  erp-decoder.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef erp_decoder_h
+#define erp_decoder_h
+
+#include <stdint.h>
+
+/* the 8 encoders under the screens (left to right), then volume, tempo
+ * and swing
+ */
+#define ERP_COUNT 11
+
+/* decode_erp returns positions in 0 ..< ERP_RANGE */
+#define ERP_RANGE 1000
+
+typedef void (erp_decoder_callback)(uint8_t *buf, int len, void *user_data);
+
+typedef struct {
+    uint8_t channel;
+    uint8_t first_cc;
+    
+    /* position change that makes up one step of relative CC */
+    int steps_per_tick;
+} erp_decoder_config;
+
+typedef struct {
+    erp_decoder_config config;
+    
+    uint16_t positions[ERP_COUNT];
+    int accumulated[ERP_COUNT];
+    int has_positions;
+    
+    erp_decoder_callback *send;
+    void *user_data;
+} erp_decoder;
+
+unsigned int decode_erp(uint8_t a, uint8_t b);
+
+void erp_decoder_init(erp_decoder *decoder, erp_decoder_callback *callback, void *user_data);
+
+/* turns an EP1_CMD_READ_ERP report (without the command byte) into the
+ * 11 positions, through a table precomputed from decode_erp
+ */
+void erp_decoder_decode(const uint8_t *report, uint16_t positions[ERP_COUNT]);
+
+/* sends the movement since the last report as relative CCs, 64 + steps
+ * for clockwise and 64 - steps for counterclockwise. returns how many
+ * were sent
+ */
+int erp_decoder_process_report(erp_decoder *decoder, const uint8_t *report, int len);
+
+#endif /* erp_decoder_h */
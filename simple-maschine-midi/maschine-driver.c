@@ -0,0 +1,3303 @@
+//
+//  maschine-driver.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 24/11/2019.
+//  Copyright © 2019 Antonio Malara. All rights reserved.
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* ppoll */
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#include <sys/select.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#endif
+
+#if defined(USB_SIMULATOR)
+#include "usb-simulator.h"
+#elif defined(__APPLE__)
+#include <libusb/libusb.h>
+#else
+#include <libusb.h>
+#endif
+
+#include "maschine-driver.h"
+#include "midi-state-machine.h"
+#include "midi-backend.h"
+#include "pad-state-machine.h"
+#include "erp-decoder.h"
+#include "button-decoder.h"
+#include "spsc-ring.h"
+#include "driver-stats.h"
+#include "driver-log.h"
+#include "usb-trace.h"
+#include "controls-map.h"
+
+const uint16_t USB_VID_NATIVEINSTRUMENTS  = 0x17cc;
+const uint16_t USB_PID_MASCHINECONTROLLER = 0x0808;
+
+enum { EP1_RESPONSE_TRANSFER_LENGTH =  64 };
+enum { EP4_RESPONSE_TRANSFER_LENGTH = 512 };
+
+/* IN transfers kept queued on each input endpoint, so that there's always
+ * one waiting while a completion is being handled
+ */
+enum { IN_TRANSFERS_PER_ENDPOINT    =   4 };
+
+/* entries of each command queue, one is always left empty. MIDI writes
+ * can come in bursts of sysex, the control commands are only sent at
+ * startup, and led_engine never has more than its two banks queued
+ */
+enum { EP1_MIDI_QUEUE_SIZE          = 512 };
+enum { EP1_CONTROL_QUEUE_SIZE       =  16 };
+enum { EP1_LEDS_QUEUE_SIZE          =   4 };
+enum { EP8_DISPLAY_QUEUE_SIZE       = 512 };
+
+/* every queued command is copied into a preallocated slot big enough for
+ * the largest payload of its endpoint. On EP1 that's a MIDI write, the 3
+ * bytes header and up to 61 bytes of MIDI, bigger than the 34 bytes LED
+ * banks. On EP8 it's the 7 bytes controller commands. Display pixels are
+ * not copied, they are sent straight from the display framebuffers
+ */
+enum { EP1_COMMAND_SLOT_SIZE        =  64 };
+enum { EP8_DISPLAY_SLOT_SIZE        =   8 };
+
+/* how many transfers can be queued in libusb at the same time for each
+ * outgoing endpoint, see maschine_driver_config
+ */
+enum { TRANSFER_WINDOW_MAX          = MASCHINE_DRIVER_TRANSFER_WINDOW_MAX };
+enum { TRANSFER_WINDOW_DEFAULT      = MASCHINE_DRIVER_TRANSFER_WINDOW_DEFAULT };
+
+const uint64_t TICK_INTERVAL_NS           = 1000000000ull / 80;
+enum { EVENT_LOOP_MAX_FDS         = 32 };
+
+static uint64_t monotonic_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+struct InEndpointStats {
+    unsigned int callbacks;
+    uint64_t callback_ns_sum;
+    uint64_t callback_ns_max;
+    
+    /* time spent with no transfer queued on the endpoint */
+    uint64_t starved_ns;
+    unsigned int resubmit_failures;
+};
+
+struct EventLoopStats {
+    int enabled;
+    
+    uint64_t window_start;
+    uint64_t wakeup_time;
+    
+    unsigned int wakeups;
+    unsigned int dispatches;
+    uint64_t dispatch_latency_sum;
+    uint64_t dispatch_latency_max;
+    
+    uint64_t ep8_bytes;
+    
+    struct InEndpointStats ep1_in;
+    struct InEndpointStats ep4_in;
+    
+    /* from the EP4 completion to the last pad message handed to the MIDI backend */
+    unsigned int pad_messages;
+    unsigned int pad_reports;
+    uint64_t pad_latency_sum;
+    uint64_t pad_latency_max;
+    
+    /* the 80 Hz tick, across every attached unit */
+    int devices;
+    unsigned int ticks;
+    uint64_t tick_ns_sum;
+    uint64_t tick_ns_max;
+};
+
+static void event_loop_stats_mark_pad_messages(struct EventLoopStats *stats, int messages, uint64_t completed_at) {
+    if (!stats->enabled)
+        return;
+    
+    uint64_t latency = monotonic_now_ns() - completed_at;
+    
+    stats->pad_messages += messages;
+    stats->pad_reports++;
+    stats->pad_latency_sum += latency;
+    
+    if (latency > stats->pad_latency_max)
+        stats->pad_latency_max = latency;
+}
+
+static void event_loop_stats_mark_dispatch(struct EventLoopStats *stats) {
+    if (!stats->enabled)
+        return;
+    
+    uint64_t latency = monotonic_now_ns() - stats->wakeup_time;
+    
+    stats->dispatches++;
+    stats->dispatch_latency_sum += latency;
+    
+    if (latency > stats->dispatch_latency_max)
+        stats->dispatch_latency_max = latency;
+}
+
+typedef void (event_loop_fd_callback)(void *user_data);
+
+struct EventLoopHandler {
+    int fd;
+    short events;
+    event_loop_fd_callback *callback;
+    void *user_data;
+};
+
+/* every file descriptor is registered with one epoll or kqueue
+ * descriptor, which is the only one the loop waits on, and which an
+ * application can wait on in its own loop.
+ *
+ * file descriptors registered without a callback belong to libusb and
+ * are serviced by libusb_handle_events_timeout
+ */
+struct EventLoop {
+    int fd;
+    struct EventLoopHandler handlers[EVENT_LOOP_MAX_FDS];
+    int nfds;
+    
+    uint64_t next_tick;
+};
+
+static int event_loop_watch(struct EventLoop *loop, int fd, short events, int add) {
+#if defined(__linux__)
+    struct epoll_event event;
+    
+    memset(&event, 0, sizeof(event));
+    event.events  = ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    
+    return epoll_ctl(loop->fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &event);
+#else
+    struct kevent changes[2];
+    int nchanges = 0;
+    
+    if (events & POLLIN)
+        EV_SET(&changes[nchanges++], fd, EVFILT_READ,  add ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    
+    if (events & POLLOUT)
+        EV_SET(&changes[nchanges++], fd, EVFILT_WRITE, add ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    
+    return kevent(loop->fd, changes, nchanges, NULL, 0, NULL);
+#endif
+}
+
+static void event_loop_add_fd(
+    struct EventLoop *loop,
+    int fd,
+    short events,
+    event_loop_fd_callback *callback,
+    void *user_data
+) {
+    if (loop->nfds >= EVENT_LOOP_MAX_FDS) {
+        driver_log("too many file descriptors, not polling fd %d\n", fd);
+        return;
+    }
+    
+    if (event_loop_watch(loop, fd, events, 1) != 0) {
+        driver_log("cannot watch file descriptor: %s\n", strerror(errno));
+        return;
+    }
+    
+    loop->handlers[loop->nfds].fd        = fd;
+    loop->handlers[loop->nfds].events    = events;
+    loop->handlers[loop->nfds].callback  = callback;
+    loop->handlers[loop->nfds].user_data = user_data;
+    
+    loop->nfds++;
+}
+
+static void event_loop_remove_fd(struct EventLoop *loop, int fd) {
+    for (int i = 0; i < loop->nfds; i++) {
+        if (loop->handlers[i].fd == fd) {
+            /* fails harmlessly if the fd has already been closed */
+            event_loop_watch(loop, fd, loop->handlers[i].events, 0);
+            
+            loop->nfds--;
+            loop->handlers[i] = loop->handlers[loop->nfds];
+            return;
+        }
+    }
+}
+
+static struct EventLoopHandler *event_loop_handler(struct EventLoop *loop, int fd) {
+    for (int i = 0; i < loop->nfds; i++) {
+        if (loop->handlers[i].fd == fd)
+            return &loop->handlers[i];
+    }
+    
+    return NULL;
+}
+
+enum { MASCHINES_MAX = MASCHINE_DRIVER_UNITS_MAX };
+
+/* opening a unit allocates its state, opens the device and creates its
+ * MIDI ports, releasing it closes them, and all of that can block. While
+ * the event thread runs it's done on the lifecycle thread instead, see
+ * lifecycle_thread_main, and the event thread only starts and stops the
+ * transfers
+ */
+enum LifecycleRequestKind {
+    LifecycleRequest_Open,
+    LifecycleRequest_Release,
+    LifecycleRequest_Quit,
+};
+
+struct LifecycleRequest {
+    enum LifecycleRequestKind kind;
+    int index;
+    
+    /* the device to open, referenced until it's opened */
+    libusb_device *device;
+    
+    /* the unit to release, or the one just opened, NULL if it failed */
+    struct Maschine *maschine;
+};
+
+/* opens waiting or done never outnumber the slots, there's room for as
+ * many releases
+ */
+enum { LIFECYCLE_RING_SIZE = 2 * MASCHINES_MAX };
+
+/* plenty to open a device and the MIDI ports, and small enough to be
+ * locked in memory with the rest of the process
+ */
+enum { LIFECYCLE_THREAD_STACK_SIZE = 512 * 1024 };
+
+struct maschine_driver {
+    maschine_driver_config config;
+    
+    libusb_context *usb;
+    libusb_hotplug_callback_handle hotplug;
+    
+    struct EventLoop loop;
+    struct EventLoopStats stats;
+    
+    /* the latency histograms, queue high water marks and failure counters */
+    driver_stats counters;
+    
+    /* what every unit's pads start with */
+    pad_engine_config pads;
+    
+    /* every unit we're attached to, all served from the one event loop. A
+     * unit that has been unplugged keeps its slot until it can be freed
+     */
+    struct Maschine *maschines[MASCHINES_MAX];
+    
+    /* points to capture while capturing, see Maschine_SubmitTransfer */
+    usb_trace *trace;
+    usb_trace capture;
+    
+    /* see capture_tick */
+    uint64_t capture_dropped_reported;
+    uint64_t capture_next_report;
+    
+    /* see maschine_driver_start_thread */
+    pthread_t thread;
+    int thread_priority;
+    int thread_started;
+    int thread_realtime;
+    _Atomic int thread_running;
+    
+    /* requests go to the lifecycle thread, what it opened comes back */
+    pthread_t lifecycle_thread;
+    int lifecycle_running;
+    spsc_ring lifecycle_requests;
+    spsc_ring lifecycle_done;
+    struct LifecycleRequest lifecycle_requests_storage[LIFECYCLE_RING_SIZE];
+    struct LifecycleRequest lifecycle_done_storage[LIFECYCLE_RING_SIZE];
+    
+    /* the devices being opened by the lifecycle thread, by slot, and
+     * whether they have been unplugged in the meantime
+     */
+    libusb_device *opening[MASCHINES_MAX];
+    int opening_left[MASCHINES_MAX];
+};
+
+static void event_loop_pollfd_added(int fd, short events, void *user_data) {
+    event_loop_add_fd((struct EventLoop *)user_data, fd, events, NULL, NULL);
+}
+
+static void event_loop_pollfd_removed(int fd, void *user_data) {
+    event_loop_remove_fd((struct EventLoop *)user_data, fd);
+}
+
+/* a buffer either points to its own slot in the queue storage, or to
+ * memory owned by someone else (see BufferQueue_AddReference). In that
+ * case the owner is told that the buffer is not in use anymore by
+ * decrementing its references counter.
+ */
+struct Buffer {
+    uint8_t *buffer;
+    int len;
+    int *references;
+    
+    /* when the oldest data in the buffer reached the driver, 0 if nobody
+     * is measuring it
+     */
+    uint64_t queued_at;
+};
+
+struct BufferQueue {
+    struct Buffer *commands;
+    int capacity;
+    uint8_t *storage;
+    size_t slot_size;
+    
+    int pad0;
+    int first;
+    int pad1;
+    int last;
+    int pad2;
+    
+    unsigned int overflows;
+    
+    /* where overflows are counted too, if set */
+    driver_stats *counters;
+};
+
+/* commands holds capacity entries, storage capacity slots of slot_size */
+void BufferQueue_Init(struct BufferQueue *queue, struct Buffer *commands, uint8_t *storage, int capacity, size_t slot_size) {
+    memset(queue, 0, sizeof(struct BufferQueue));
+    memset(commands, 0, capacity * sizeof(struct Buffer));
+    queue->commands = commands;
+    queue->capacity = capacity;
+    queue->first = 0;
+    queue->last = 0;
+    queue->storage = storage;
+    queue->slot_size = slot_size;
+}
+
+static struct Buffer* BufferQueue_Push(struct BufferQueue *queue) {
+    int next = queue->last + 1;
+    
+    if (next >= queue->capacity)
+        next -= queue->capacity;
+    
+    if (next == queue->first) {
+        queue->overflows++;
+        
+        if (queue->counters)
+            driver_stats_count(queue->counters, DRIVER_COUNTER_QUEUE_OVERFLOWS);
+        
+        driver_log("command queue %p overflow\n", queue);
+        return NULL;
+    }
+    
+    struct Buffer *buffer = &queue->commands[queue->last];
+    queue->last = next;
+    
+    return buffer;
+}
+
+struct Buffer* BufferQueue_Add(struct BufferQueue *queue, uint8_t *command, int len) {
+    if (len < 0 || (size_t)len > queue->slot_size) {
+        driver_log("command of %d bytes does not fit queue %p\n", len, queue);
+        return NULL;
+    }
+    
+    struct Buffer *buffer = BufferQueue_Push(queue);
+    
+    if (buffer == NULL)
+        return NULL;
+    
+    int slot = (int)(buffer - queue->commands);
+    
+    buffer->buffer = queue->storage + (slot * queue->slot_size);
+    buffer->len = len;
+    buffer->references = NULL;
+    buffer->queued_at = 0;
+    memcpy(buffer->buffer, command, len);
+    
+    return buffer;
+}
+
+/* queues data without copying it, the caller must keep it untouched
+ * until *references goes back to what it was before this call
+ */
+struct Buffer* BufferQueue_AddReference(struct BufferQueue *queue, uint8_t *data, int len, int *references) {
+    struct Buffer *buffer = BufferQueue_Push(queue);
+    
+    if (buffer == NULL)
+        return NULL;
+    
+    buffer->buffer = data;
+    buffer->len = len;
+    buffer->references = references;
+    buffer->queued_at = 0;
+    (*references)++;
+    
+    return buffer;
+}
+
+int BufferQueue_IsEmpty(struct BufferQueue *queue) {
+    return queue->first == queue->last;
+}
+
+int BufferQueue_Count(struct BufferQueue *queue) {
+    int count = queue->last - queue->first;
+    
+    if (count < 0)
+        count += queue->capacity;
+    
+    return count;
+}
+
+struct Buffer* BufferQueue_Peek(struct BufferQueue *queue) {
+    if (BufferQueue_IsEmpty(queue)) {
+        return NULL;
+    }
+    
+    return &queue->commands[queue->first];
+}
+
+/* the buffer offset entries after the head of the queue, if any */
+struct Buffer* BufferQueue_At(struct BufferQueue *queue, int offset) {
+    if (offset >= BufferQueue_Count(queue))
+        return NULL;
+    
+    int index = queue->first + offset;
+    
+    if (index >= queue->capacity)
+        index -= queue->capacity;
+    
+    return &queue->commands[index];
+}
+
+int BufferQueue_Offset(struct BufferQueue *queue, struct Buffer *buffer) {
+    int offset = (int)(buffer - queue->commands) - queue->first;
+    
+    if (offset < 0)
+        offset += queue->capacity;
+    
+    return offset;
+}
+
+struct Buffer* BufferQueue_PeekLast(struct BufferQueue *queue) {
+    if (BufferQueue_IsEmpty(queue)) {
+        return NULL;
+    }
+    
+    int last = queue->last - 1;
+    
+    if (last < 0)
+        last += queue->capacity;
+    
+    return &queue->commands[last];
+}
+
+void BufferQueue_Remove(struct BufferQueue *queue) {
+    if (BufferQueue_IsEmpty(queue)) {
+        return;
+    }
+
+    struct Buffer *buffer = &queue->commands[queue->first];
+    
+    if (buffer->references)
+        (*buffer->references)--;
+    
+    buffer->len = 0;
+    buffer->references = NULL;
+
+    queue->first = queue->first + 1;
+    
+    if (queue->first >= queue->capacity) {
+        queue->first = 0;
+    }
+}
+
+enum { MASCHINE_LED_MAX_VAL   = 63 };
+enum { MASCHINE_LED_BANK_SIZE = 32 };
+enum { MASCHINE_LED_CMD_SIZE  = MASCHINE_LED_BANK_SIZE + 2 };
+enum { MASCHINE_LED_BANK0     = MASCHINE_LED_CMD_SIZE * 0 };
+enum { MASCHINE_LED_BANK1     = MASCHINE_LED_CMD_SIZE * 1 };
+
+typedef uint8_t MaschineLedState[MASCHINE_LED_CMD_SIZE * 2];
+
+/* keeps the LED state and sends a bank only when it changed since the
+ * last acknowledged transfer. A bank has at most one command in the
+ * queue: while it's still waiting to be sent, new changes are written
+ * over it in place.
+ */
+struct led_engine {
+    MaschineLedState state;
+    int dirty[2];
+    struct Buffer *pending[2];
+};
+
+struct led_show_state {
+    int num_pads;
+    int show_pads;
+};
+
+enum { display_width     = MASCHINE_DISPLAY_WIDTH };
+enum { display_height    = MASCHINE_DISPLAY_HEIGHT };
+
+enum { display_row_size  = MASCHINE_DISPLAY_ROW_SIZE };
+enum { display_data_size = display_row_size * display_height };
+
+/* the pixels of a frame are streamed in slices of up to 502 bytes, as
+ * many as fit a transfer: a whole frame is 22 of them. A partial update
+ * starts at the first row that changed, only the start of the stream is
+ * row aligned. Every slice is staged with room for its 4 bytes header in
+ * front of it
+ */
+enum { display_slice_size        = 502 };
+enum { display_slice_header_size = 4 };
+enum { display_slice_stride      = display_slice_header_size + display_slice_size };
+enum { display_slices            = (display_data_size + display_slice_size - 1) / display_slice_size };
+
+typedef uint8_t MaschineDisplayData[display_data_size];
+
+/* pixels can be drawn at any time, a present copies the rows that
+ * changed into slices and EP8 transfers point into those. While
+ * slices_in_flight is not zero the slices are left alone, and a present
+ * is held in present_pending until the last of them is out.
+ *
+ * shadow is what was last sent to the display, to only send the rows
+ * that changed
+ */
+struct display_framebuffer {
+    MaschineDisplayData pixels;
+    
+    uint8_t slices[display_slices][display_slice_stride];
+    int slices_in_flight;
+    int present_pending;
+    
+    MaschineDisplayData shadow;
+    int shadow_valid;
+};
+
+enum { HOST_REQUESTS_RING_SIZE = 256 };
+enum { HOST_REQUEST_DATA_SIZE  = 61 };
+
+/* MIDI writes coming from the host MIDI thread, handed to the usb thread
+ * through the host_requests ring. LEDs are only ever set from the driver
+ * thread, see maschine_driver_set_led
+ */
+struct HostRequest {
+    uint8_t len;
+    uint8_t data[HOST_REQUEST_DATA_SIZE];
+    uint64_t received_at;
+};
+
+/* transfers are recycled in submission order: libusb completes the
+ * transfers of an endpoint in the same order they were submitted, so the
+ * oldest in flight always belongs to the head of the queue
+ */
+struct TransferWindow {
+    struct libusb_transfer *transfers[TRANSFER_WINDOW_MAX];
+    uint64_t submitted_at[TRANSFER_WINDOW_MAX];
+    
+    /* what each transfer carries, for windows fed from several queues */
+    uint8_t tags[TRANSFER_WINDOW_MAX];
+    
+    int size;
+    int in_flight;
+    int next;
+    int cancelled;
+    
+    driver_stats *counters;
+};
+
+/* a ring of IN transfers, each one is resubmitted as soon as its
+ * completion has been handled. Like for the TransferWindow, libusb
+ * completes them in submission order
+ */
+struct InEndpoint {
+    struct libusb_transfer *transfers[IN_TRANSFERS_PER_ENDPOINT];
+    uint64_t submitted_at[IN_TRANSFERS_PER_ENDPOINT];
+    struct InEndpointStats *stats;
+    driver_stats *counters;
+    enum driver_latency transfer_latency;
+    int queued;
+    int cancelled;
+    uint64_t starved_since;
+    
+    /* the slot the next replayed completion is handed to */
+    int replay_next;
+};
+
+/* EP1 commands are queued by class, and sent in strict priority order:
+ * MIDI writes first, then the device control commands, then the LEDs.
+ * Within a class they keep their order, see ep1_scheduler_next
+ */
+enum Ep1Class {
+    Ep1Class_Midi,
+    Ep1Class_Control,
+    Ep1Class_Leds,
+};
+
+enum { EP1_CLASS_COUNT = Ep1Class_Leds + 1 };
+
+/* a class with commands waiting is passed over at most this many times
+ * in a row, so that a sysex dump cannot hold back the LEDs forever
+ */
+enum { EP1_STARVATION_LIMIT = 8 };
+
+/* puts every EP1 command in the MIDI queue, so that they are sent in the
+ * order they were queued, as before the classes. Only the bench sets it,
+ * before opening a driver, as the baseline the scheduler is measured
+ * against
+ */
+static int ep1_scheduler_fifo = 0;
+
+struct Maschine {
+    struct maschine_driver *driver;
+    libusb_device_handle *usb_handle;
+    
+    /* slot in the registry, also used to number the MIDI ports */
+    int index;
+    
+    /* unplugged, waiting for libusb to hand back its transfers */
+    int closing;
+    
+    /* fed from a trace rather than a device, see maschine_driver_replay */
+    int replaying;
+    
+    struct TransferWindow ep1_command_window;
+    struct InEndpoint ep1_command_responses;
+    struct InEndpoint ep4_pad_reports;
+    struct TransferWindow ep8_display_window;
+    
+    uint8_t ep1_command_response_buffers[IN_TRANSFERS_PER_ENDPOINT][EP1_RESPONSE_TRANSFER_LENGTH];
+    uint8_t ep4_pad_report_buffers[IN_TRANSFERS_PER_ENDPOINT][EP4_RESPONSE_TRANSFER_LENGTH];
+    
+    struct BufferQueue command_queues[EP1_CLASS_COUNT];
+    struct BufferQueue display_queue;
+    
+    /* the in flight commands of a class are the head of its queue */
+    int commands_in_flight[EP1_CLASS_COUNT];
+    int commands_passed_over[EP1_CLASS_COUNT];
+    
+    struct Buffer midi_queue_buffers[EP1_MIDI_QUEUE_SIZE];
+    struct Buffer control_queue_buffers[EP1_CONTROL_QUEUE_SIZE];
+    struct Buffer leds_queue_buffers[EP1_LEDS_QUEUE_SIZE];
+    struct Buffer display_queue_buffers[EP8_DISPLAY_QUEUE_SIZE];
+    
+    uint8_t midi_queue_storage[EP1_MIDI_QUEUE_SIZE][EP1_COMMAND_SLOT_SIZE];
+    uint8_t control_queue_storage[EP1_CONTROL_QUEUE_SIZE][EP1_COMMAND_SLOT_SIZE];
+    uint8_t leds_queue_storage[EP1_LEDS_QUEUE_SIZE][EP1_COMMAND_SLOT_SIZE];
+    uint8_t display_queue_storage[EP8_DISPLAY_QUEUE_SIZE][EP8_DISPLAY_SLOT_SIZE];
+    
+    midi_port *midi;
+    
+    spsc_ring host_requests;
+    struct HostRequest host_requests_storage[HOST_REQUESTS_RING_SIZE];
+    
+    /* when the transfer being handled completed, the MIDI it produces is
+     * stamped with it and flushed to the host at the end of its callback
+     */
+    uint64_t midi_timestamp;
+    
+    /* what the MIDI waiting for the flush comes from, for the stats */
+    enum driver_latency midi_source;
+    int midi_pending;
+    
+    midi_parser parser;
+    pad_engine pads;
+    erp_decoder erps;
+    button_decoder buttons;
+    struct led_engine leds;
+    struct led_show_state led_show;
+    int display_init_state;
+    struct display_framebuffer displays[2];
+};
+
+enum EP1_COMMANDS {
+    EP1_CMD_GET_DEVICE_INFO = 0x1,
+    EP1_CMD_READ_ERP        = 0x2,
+    EP1_CMD_READ_ANALOG     = 0x3,
+    EP1_CMD_READ_IO         = 0x4,
+    EP1_CMD_WRITE_IO        = 0x5,
+    EP1_CMD_MIDI_READ       = 0x6,
+    EP1_CMD_MIDI_WRITE      = 0x7,
+    EP1_CMD_AUDIO_PARAMS    = 0x9,
+    EP1_CMD_AUTO_MSG        = 0xb,
+    EP1_CMD_DIMM_LEDS       = 0xc,
+};
+
+struct caiaq_device_spec {
+    uint16_t fw_version;
+    uint8_t  hw_subtype;
+    uint8_t  num_erp;
+    uint8_t  num_analog_in;
+    uint8_t  num_digital_in;
+    uint8_t  num_digital_out;
+    uint8_t  num_analog_audio_out;
+    uint8_t  num_analog_audio_in;
+    uint8_t  num_digital_audio_out;
+    uint8_t  num_digital_audio_in;
+    uint8_t  num_midi_out;
+    uint8_t  num_midi_in;
+    uint8_t  data_alignment;
+} __attribute__ ((packed));
+
+/* every transfer of a unit is submitted through here, and its callback
+ * starts with Maschine_TransferCompleted: that's where a capture taps the
+ * traffic. The user_data of a transfer is always its unit.
+ *
+ * a replaying unit has no device, its transfers stay pending until the
+ * replay completes them
+ */
+static int Maschine_SubmitTransfer(struct libusb_transfer *transfer) {
+    struct Maschine *maschine = (struct Maschine *)transfer->user_data;
+    usb_trace *trace = maschine->driver->trace;
+    
+    int r = maschine->replaying ? LIBUSB_SUCCESS : libusb_submit_transfer(transfer);
+    
+    if (trace && r == LIBUSB_SUCCESS) {
+        int out = !(transfer->endpoint & 0x80);
+        
+        usb_trace_add(
+            trace,
+            monotonic_now_ns(),
+            USB_TRACE_SUBMIT,
+            maschine->index,
+            transfer->endpoint,
+            0,
+            out ? transfer->buffer : NULL,
+            out ? transfer->length : 0
+        );
+    }
+    
+    return r;
+}
+
+static void Maschine_TransferCompleted(struct libusb_transfer *transfer) {
+    struct Maschine *maschine = (struct Maschine *)transfer->user_data;
+    usb_trace *trace = maschine->driver->trace;
+    
+    if (trace == NULL)
+        return;
+    
+    int in = transfer->endpoint & 0x80;
+    
+    usb_trace_add(
+        trace,
+        monotonic_now_ns(),
+        USB_TRACE_COMPLETE,
+        maschine->index,
+        transfer->endpoint,
+        transfer->status,
+        in ? transfer->buffer : NULL,
+        in ? transfer->actual_length : 0
+    );
+}
+
+static int InEndpoint_Slot(struct InEndpoint *endpoint, struct libusb_transfer *transfer) {
+    for (int i = 0; i < IN_TRANSFERS_PER_ENDPOINT; i++) {
+        if (endpoint->transfers[i] == transfer)
+            return i;
+    }
+    
+    return 0;
+}
+
+static uint64_t InEndpoint_Completed(struct InEndpoint *endpoint, struct libusb_transfer *transfer) {
+    uint64_t now = monotonic_now_ns();
+    
+    endpoint->queued--;
+    
+    if (endpoint->queued == 0)
+        endpoint->starved_since = now;
+    
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        uint64_t submitted_at = endpoint->submitted_at[InEndpoint_Slot(endpoint, transfer)];
+        driver_stats_record(endpoint->counters, endpoint->transfer_latency, now - submitted_at);
+    }
+    
+    return now;
+}
+
+static void InEndpoint_Resubmit(
+    struct InEndpoint *endpoint,
+    struct libusb_transfer *transfer,
+    uint64_t completed_at
+) {
+    struct InEndpointStats *stats = endpoint->stats;
+    
+    /* the device is gone, or we're tearing it down */
+    if (transfer->status == LIBUSB_TRANSFER_CANCELLED ||
+        transfer->status == LIBUSB_TRANSFER_NO_DEVICE ||
+        endpoint->cancelled)
+        return;
+    
+    int r = Maschine_SubmitTransfer(transfer);
+    uint64_t now = monotonic_now_ns();
+    
+    if (r != LIBUSB_SUCCESS) {
+        driver_log("failed to resubmit transfer on endpoint %02x: %d\n", transfer->endpoint, r);
+        stats->resubmit_failures++;
+        driver_stats_count(endpoint->counters, DRIVER_COUNTER_RESUBMIT_FAILURES);
+    }
+    else {
+        if (endpoint->queued == 0)
+            stats->starved_ns += now - endpoint->starved_since;
+        
+        endpoint->queued++;
+        endpoint->submitted_at[InEndpoint_Slot(endpoint, transfer)] = now;
+    }
+    
+    uint64_t duration = now - completed_at;
+    
+    stats->callbacks++;
+    stats->callback_ns_sum += duration;
+    
+    if (duration > stats->callback_ns_max)
+        stats->callback_ns_max = duration;
+}
+
+static void InEndpoint_Start(
+    struct InEndpoint *endpoint,
+    struct InEndpointStats *stats,
+    enum driver_latency transfer_latency,
+    libusb_device_handle *usb_handle,
+    uint8_t address,
+    uint8_t *buffers,
+    int buffer_size,
+    libusb_transfer_cb_fn callback,
+    void *user_data
+) {
+    endpoint->stats = stats;
+    endpoint->transfer_latency = transfer_latency;
+    
+    for (int i = 0; i < IN_TRANSFERS_PER_ENDPOINT; i++) {
+        libusb_fill_bulk_transfer(
+            endpoint->transfers[i],
+            usb_handle,
+            address,
+            buffers + (i * buffer_size),
+            buffer_size,
+            callback,
+            user_data,
+            0
+        );
+        
+        endpoint->submitted_at[i] = monotonic_now_ns();
+        
+        int r = Maschine_SubmitTransfer(endpoint->transfers[i]);
+        if (r < 0) {
+            driver_log("cannot submit transfer on endpoint %02x: %d\n", address, r);
+            driver_stats_count(endpoint->counters, DRIVER_COUNTER_SUBMIT_FAILURES);
+            continue;
+        }
+        
+        endpoint->queued++;
+    }
+}
+
+static int InEndpoint_Alloc(struct InEndpoint *endpoint) {
+    for (int i = 0; i < IN_TRANSFERS_PER_ENDPOINT; i++) {
+        endpoint->transfers[i] = libusb_alloc_transfer(0);
+        
+        if (endpoint->transfers[i] == NULL)
+            return -1;
+    }
+    
+    return 0;
+}
+
+static void InEndpoint_Free(struct InEndpoint *endpoint) {
+    for (int i = 0; i < IN_TRANSFERS_PER_ENDPOINT; i++) {
+        libusb_free_transfer(endpoint->transfers[i]);
+        endpoint->transfers[i] = NULL;
+    }
+}
+
+static void InEndpoint_Cancel(struct InEndpoint *endpoint) {
+    endpoint->cancelled = 1;
+    
+    for (int i = 0; i < IN_TRANSFERS_PER_ENDPOINT; i++) {
+        if (endpoint->transfers[i])
+            libusb_cancel_transfer(endpoint->transfers[i]);
+    }
+}
+
+/* completes the next pending transfer with a recorded payload, through
+ * the endpoint callback, as libusb would
+ */
+static void InEndpoint_Replay(struct InEndpoint *endpoint, int status, const uint8_t *payload, int length) {
+    if (endpoint->queued == 0 || endpoint->cancelled)
+        return;
+    
+    struct libusb_transfer *transfer = endpoint->transfers[endpoint->replay_next];
+    
+    endpoint->replay_next = (endpoint->replay_next + 1) % IN_TRANSFERS_PER_ENDPOINT;
+    
+    if (length > transfer->length)
+        length = transfer->length;
+    
+    memcpy(transfer->buffer, payload, length);
+    transfer->status = status;
+    transfer->actual_length = length;
+    
+    transfer->callback(transfer);
+}
+
+static void midi_flush(struct Maschine * maschine);
+
+/* a reply the device sent on EP1, len is at least 1 */
+static void ep1_command_response(struct Maschine *maschine, uint8_t *buffer, int len) {
+    enum EP1_COMMANDS cmd = buffer[0];
+    
+    switch (cmd) {
+        case EP1_CMD_GET_DEVICE_INFO:
+        {
+            struct caiaq_device_spec *
+            reply = (struct caiaq_device_spec *)&(buffer[1]);
+            
+            reply = reply;
+            
+            break;
+        }
+            
+        case EP1_CMD_READ_ERP:
+        {
+            maschine->midi_source = DRIVER_LATENCY_ERPS;
+            
+            erp_decoder_process_report(
+                &maschine->erps,
+                buffer + 1,
+                len - 1
+            );
+            
+            break;
+        }
+
+        case EP1_CMD_READ_IO:
+        {
+            maschine->midi_source = DRIVER_LATENCY_BUTTONS;
+            
+            button_decoder_process_report(
+                &maschine->buttons,
+                buffer + 1,
+                len - 1
+            );
+            
+            break;
+        }
+        
+        case EP1_CMD_MIDI_READ:
+        {
+            /* never past what the device actually sent */
+            int available = len > 3 ? len - 3 : 0;
+            
+            uint8_t * midi = buffer + 3;
+            int       midi_len = buffer[2] < available ? buffer[2] : available;
+
+            maschine->midi_source = DRIVER_LATENCY_DIN_MIDI;
+            midi_parser_parse_buffer(&maschine->parser, midi, midi_len);
+            
+            break;
+        }
+        
+        case EP1_CMD_MIDI_WRITE:
+        case EP1_CMD_DIMM_LEDS:
+        case EP1_CMD_AUTO_MSG:
+            break;
+            
+        default:
+            driver_log("unhandled command reply %02x\n", cmd);
+            break;
+    }
+}
+
+static void ep1_command_responses_callback(struct libusb_transfer * transfer) {
+    struct Maschine *maschine = (struct Maschine *)transfer->user_data;
+    
+    Maschine_TransferCompleted(transfer);
+    
+    uint64_t completed_at = InEndpoint_Completed(&maschine->ep1_command_responses, transfer);
+    
+    maschine->midi_timestamp = completed_at;
+    event_loop_stats_mark_dispatch(&maschine->driver->stats);
+    
+    /* a failed transfer leaves whatever an earlier reply put in its buffer */
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length >= 1)
+        ep1_command_response(maschine, transfer->buffer, transfer->actual_length);
+    
+    midi_flush(maschine);
+    InEndpoint_Resubmit(&maschine->ep1_command_responses, transfer, completed_at);
+}
+
+static void ep4_pad_pressure_report_transfer_callback(struct libusb_transfer * transfer) {
+    struct Maschine *maschine = (struct Maschine *)transfer->user_data;
+    
+    Maschine_TransferCompleted(transfer);
+    
+    uint64_t completed_at = InEndpoint_Completed(&maschine->ep4_pad_reports, transfer);
+
+    maschine->midi_timestamp = completed_at;
+    maschine->midi_source = DRIVER_LATENCY_PADS;
+    event_loop_stats_mark_dispatch(&maschine->driver->stats);
+    
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        int sent = pad_engine_process_report(&maschine->pads, transfer->buffer, transfer->actual_length);
+        
+        midi_flush(maschine);
+        
+        if (sent)
+            event_loop_stats_mark_pad_messages(&maschine->driver->stats, sent, completed_at);
+    }
+    
+    InEndpoint_Resubmit(&maschine->ep4_pad_reports, transfer, completed_at);
+}
+
+static int TransferWindow_Submit(
+    struct TransferWindow *window,
+    struct Buffer *buffer,
+    int tag,
+    libusb_device_handle *usb_handle,
+    uint8_t endpoint,
+    libusb_transfer_cb_fn callback,
+    void *user_data
+) {
+    struct libusb_transfer *transfer = window->transfers[window->next];
+    
+    libusb_fill_bulk_transfer(
+        transfer,
+        usb_handle,
+        endpoint,
+        buffer->buffer,
+        buffer->len,
+        callback,
+        user_data,
+        0
+    );
+    
+    window->submitted_at[window->next] = monotonic_now_ns();
+    window->tags[window->next] = tag;
+    
+    int r = Maschine_SubmitTransfer(transfer);
+    if (r != LIBUSB_SUCCESS) {
+        driver_log("failed to submit transfer on endpoint %02x: %d\n", endpoint, r);
+        driver_stats_count(window->counters, DRIVER_COUNTER_SUBMIT_FAILURES);
+        return r;
+    }
+    
+    window->in_flight++;
+    window->next = (window->next + 1) % TRANSFER_WINDOW_MAX;
+    
+    return LIBUSB_SUCCESS;
+}
+
+/* the transfers are allocated up front, so that nothing is allocated
+ * while the unit runs. Every slot is used in turn, whatever the size
+ */
+static int TransferWindow_Alloc(struct TransferWindow *window) {
+    for (int i = 0; i < TRANSFER_WINDOW_MAX; i++) {
+        window->transfers[i] = libusb_alloc_transfer(0);
+        
+        if (window->transfers[i] == NULL)
+            return -1;
+    }
+    
+    return 0;
+}
+
+static void TransferWindow_Free(struct TransferWindow *window) {
+    for (int i = 0; i < TRANSFER_WINDOW_MAX; i++) {
+        libusb_free_transfer(window->transfers[i]);
+        window->transfers[i] = NULL;
+    }
+}
+
+static void TransferWindow_Fill(
+    struct TransferWindow *window,
+    struct BufferQueue *queue,
+    libusb_device_handle *usb_handle,
+    uint8_t endpoint,
+    libusb_transfer_cb_fn callback,
+    void *user_data
+) {
+    if (window->cancelled)
+        return;
+    
+    while (window->in_flight < window->size) {
+        struct Buffer *buffer = BufferQueue_At(queue, window->in_flight);
+        
+        if (!buffer)
+            return;
+        
+        if (TransferWindow_Submit(window, buffer, 0, usb_handle, endpoint, callback, user_data) != LIBUSB_SUCCESS)
+            return;
+    }
+}
+
+static int TransferWindow_Oldest(struct TransferWindow *window) {
+    return (window->next - window->in_flight + TRANSFER_WINDOW_MAX) % TRANSFER_WINDOW_MAX;
+}
+
+/* the oldest transfer in flight is done, returns when it was submitted */
+static uint64_t TransferWindow_Completed(struct TransferWindow *window) {
+    int oldest = TransferWindow_Oldest(window);
+    
+    window->in_flight--;
+    
+    return window->submitted_at[oldest];
+}
+
+/* completes what a replaying unit has in flight, and whatever the
+ * callbacks submit in turn, as if the device had taken it all at once
+ */
+static void TransferWindow_Replay(struct TransferWindow *window) {
+    while (window->in_flight > 0 && !window->cancelled) {
+        struct libusb_transfer *transfer = window->transfers[TransferWindow_Oldest(window)];
+        
+        transfer->status = LIBUSB_TRANSFER_COMPLETED;
+        transfer->actual_length = transfer->length;
+        
+        transfer->callback(transfer);
+    }
+}
+
+static void TransferWindow_Cancel(struct TransferWindow *window) {
+    window->cancelled = 1;
+    
+    for (int i = 0; i < window->in_flight; i++) {
+        int index = (window->next - window->in_flight + i + TRANSFER_WINDOW_MAX) % TRANSFER_WINDOW_MAX;
+        libusb_cancel_transfer(window->transfers[index]);
+    }
+}
+
+/* transfers in flight can't be overtaken, whatever is submitted is ahead
+ * of the next MIDI write, and a MIDI write can't take more messages once
+ * submitted. So while anything is in flight only a MIDI write that is
+ * already followed by another, one that can't grow anymore, joins it: a
+ * sysex dump still fills the window, while a LED bank or a write that's
+ * still collecting notes waits for the window to empty
+ */
+static int ep1_command_ready(struct Maschine * maschine, enum Ep1Class class) {
+    int in_flight = maschine->commands_in_flight[class];
+    int queued = BufferQueue_Count(&maschine->command_queues[class]);
+    
+    if (ep1_scheduler_fifo || maschine->ep1_command_window.in_flight == 0)
+        return queued > in_flight;
+    
+    return class == Ep1Class_Midi && queued > in_flight + 1;
+}
+
+/* the class to send the next command from, -1 if none may be sent. The
+ * highest priority class with a command ready goes first, unless a lower
+ * one has been passed over too many times
+ */
+static int ep1_scheduler_next(struct Maschine * maschine) {
+    int ready[EP1_CLASS_COUNT];
+    int chosen = -1;
+    
+    for (int class = 0; class < EP1_CLASS_COUNT; class++) {
+        ready[class] = ep1_command_ready(maschine, class);
+        
+        if (ready[class] && chosen < 0)
+            chosen = class;
+    }
+    
+    if (chosen < 0)
+        return -1;
+    
+    for (int class = EP1_CLASS_COUNT - 1; class > chosen; class--) {
+        if (ready[class] && maschine->commands_passed_over[class] >= EP1_STARVATION_LIMIT) {
+            chosen = class;
+            break;
+        }
+    }
+    
+    maschine->commands_passed_over[chosen] = 0;
+    
+    for (int class = chosen + 1; class < EP1_CLASS_COUNT; class++) {
+        if (ready[class])
+            maschine->commands_passed_over[class]++;
+    }
+    
+    return chosen;
+}
+
+static void send_command_async_callback(struct libusb_transfer *transfer);
+
+static void send_command_async(struct Maschine * maschine) {
+    struct TransferWindow *window = &maschine->ep1_command_window;
+    
+    if (window->cancelled)
+        return;
+    
+    while (window->in_flight < window->size) {
+        int class = ep1_scheduler_next(maschine);
+        
+        if (class < 0)
+            return;
+        
+        struct Buffer *buffer = BufferQueue_At(
+            &maschine->command_queues[class],
+            maschine->commands_in_flight[class]
+        );
+        
+        int r = TransferWindow_Submit(
+            window,
+            buffer,
+            class,
+            maschine->usb_handle,
+            0x01,
+            send_command_async_callback,
+            maschine
+        );
+        
+        if (r != LIBUSB_SUCCESS)
+            return;
+        
+        maschine->commands_in_flight[class]++;
+    }
+}
+
+static void led_engine_transfer_done(struct Maschine *maschine, struct Buffer *buffer, int ok);
+
+static void send_command_async_callback(struct libusb_transfer *transfer) {
+    Maschine_TransferCompleted(transfer);
+    
+    struct Maschine *maschine = (struct Maschine *)transfer->user_data;
+    int class = maschine->ep1_command_window.tags[TransferWindow_Oldest(&maschine->ep1_command_window)];
+    struct BufferQueue *queue = &maschine->command_queues[class];
+    struct Buffer *buffer = BufferQueue_Peek(queue);
+    int ok = transfer->status == LIBUSB_TRANSFER_COMPLETED;
+    
+    uint64_t now = monotonic_now_ns();
+    uint64_t submitted_at = TransferWindow_Completed(&maschine->ep1_command_window);
+    
+    if (ok) {
+        driver_stats_record(&maschine->driver->counters, DRIVER_LATENCY_EP1_OUT, now - submitted_at);
+        
+        if (buffer && buffer->queued_at)
+            driver_stats_record(&maschine->driver->counters, DRIVER_LATENCY_MIDI_OUT, now - buffer->queued_at);
+    }
+    
+    led_engine_transfer_done(maschine, buffer, ok);
+    
+    BufferQueue_Remove(queue);
+    maschine->commands_in_flight[class]--;
+    
+    send_command_async(maschine);
+}
+
+static int command_is_in_flight(struct Maschine * maschine, enum Ep1Class class, struct Buffer *buffer) {
+    return
+        BufferQueue_Offset(&maschine->command_queues[class], buffer) <
+        maschine->commands_in_flight[class];
+}
+
+static enum Ep1Class ep1_command_class(uint8_t command) {
+    if (ep1_scheduler_fifo)
+        return Ep1Class_Midi;
+    
+    switch (command) {
+        case EP1_CMD_MIDI_WRITE:
+            return Ep1Class_Midi;
+            
+        case EP1_CMD_DIMM_LEDS:
+            return Ep1Class_Leds;
+            
+        default:
+            return Ep1Class_Control;
+    }
+}
+
+static struct Buffer * send_command(struct Maschine * maschine, uint8_t *buffer, int len) {
+    struct Buffer *queued = BufferQueue_Add(&maschine->command_queues[ep1_command_class(buffer[0])], buffer, len);
+    int depth = 0;
+    
+    for (int class = 0; class < EP1_CLASS_COUNT; class++)
+        depth += BufferQueue_Count(&maschine->command_queues[class]);
+    
+    driver_stats_queue_depth(&maschine->driver->counters, DRIVER_QUEUE_COMMANDS, depth);
+    send_command_async(maschine);
+    
+    return queued;
+}
+
+const int EP1_MIDI_WRITE_HEADER_SIZE = 3;
+const int EP1_MIDI_WRITE_MAX_DATA    = EP1_COMMAND_SLOT_SIZE - EP1_MIDI_WRITE_HEADER_SIZE;
+
+static int append_to_queued_midi_write(struct Maschine * maschine, const uint8_t *data, int len) {
+    struct Buffer *last = BufferQueue_PeekLast(&maschine->command_queues[Ep1Class_Midi]);
+    
+    if (last == NULL || last->buffer[0] != EP1_CMD_MIDI_WRITE)
+        return 0;
+    
+    /* the head of the queue may already be owned by libusb */
+    if (command_is_in_flight(maschine, Ep1Class_Midi, last))
+        return 0;
+    
+    if (last->len + len > EP1_COMMAND_SLOT_SIZE)
+        return 0;
+    
+    memcpy(last->buffer + last->len, data, len);
+    last->len += len;
+    last->buffer[2] += len;
+    
+    return 1;
+}
+
+static void send_command_midi_write(
+    struct Maschine * maschine,
+    const uint8_t *data,
+    int len,
+    uint64_t received_at
+) {
+    /* messages are appended to the last queued write frame if they fit
+     * whole, so that a burst goes out in as few transfers as possible.
+     * only messages longer than a frame (sysex) are split
+     */
+    
+    if (len <= EP1_MIDI_WRITE_MAX_DATA && append_to_queued_midi_write(maschine, data, len))
+        return;
+    
+    while (len > 0) {
+        int chunk = len < EP1_MIDI_WRITE_MAX_DATA ? len : EP1_MIDI_WRITE_MAX_DATA;
+        
+        uint8_t command[EP1_COMMAND_SLOT_SIZE];
+        command[0] = EP1_CMD_MIDI_WRITE;
+        command[1] = 0;
+        command[2] = chunk;
+        memcpy(command + EP1_MIDI_WRITE_HEADER_SIZE, data, chunk);
+        
+        struct Buffer *queued = send_command(maschine, command, chunk + EP1_MIDI_WRITE_HEADER_SIZE);
+        
+        if (queued)
+            queued->queued_at = received_at;
+        
+        data += chunk;
+        len  -= chunk;
+    }
+}
+
+static void send_command_get_device_info(struct Maschine * maschine) {
+    uint8_t command[] = { EP1_CMD_GET_DEVICE_INFO };
+    send_command(maschine, command, sizeof(command));
+}
+
+static void send_command_set_auto_message(
+    struct Maschine *maschine,
+    uint8_t digital,
+    uint8_t analog,
+    uint8_t erp
+) {
+    uint8_t command[] = {
+        EP1_CMD_AUTO_MSG,
+        digital,
+        analog,
+        erp,
+    };
+    
+    send_command(maschine, command, sizeof(command));
+}
+
+void MaschineLedState_Init(MaschineLedState state) {
+    memset(state, 0, sizeof(MaschineLedState));
+    
+    state[MASCHINE_LED_BANK0 + 0] = EP1_CMD_DIMM_LEDS;
+    state[MASCHINE_LED_BANK0 + 1] = 0x00;
+    
+    state[MASCHINE_LED_BANK1 + 0] = EP1_CMD_DIMM_LEDS;
+    state[MASCHINE_LED_BANK1 + 1] = 0x1e;
+}
+
+/* returns non zero if the LED value actually changed */
+int MaschineLedState_SetLed(MaschineLedState state, enum MaschineLeds led, int on) {
+    int bank = ((int)led < MASCHINE_LED_BANK_SIZE)
+        ? MASCHINE_LED_BANK0
+        : MASCHINE_LED_BANK1;
+    
+    uint8_t *value = &state[bank + 2 + (led % MASCHINE_LED_BANK_SIZE)];
+    uint8_t  new_value = on ? MASCHINE_LED_MAX_VAL : 0;
+    
+    if (*value == new_value)
+        return 0;
+    
+    *value = new_value;
+    return 1;
+}
+
+static void led_engine_init(struct led_engine *leds) {
+    memset(leds, 0, sizeof(struct led_engine));
+    MaschineLedState_Init(leds->state);
+    
+    /* the device state is unknown, so everything goes out once */
+    leds->dirty[0] = 1;
+    leds->dirty[1] = 1;
+}
+
+static void led_engine_set_led(struct led_engine *leds, enum MaschineLeds led, int on) {
+    if (MaschineLedState_SetLed(leds->state, led, on))
+        leds->dirty[led / MASCHINE_LED_BANK_SIZE] = 1;
+}
+
+static void led_engine_flush(struct Maschine * maschine) {
+    struct led_engine *leds = &maschine->leds;
+    
+    for (int bank = 0; bank < 2; bank++) {
+        if (!leds->dirty[bank])
+            continue;
+        
+        uint8_t *command = &leds->state[bank * MASCHINE_LED_CMD_SIZE];
+        struct Buffer *pending = leds->pending[bank];
+        
+        if (pending == NULL) {
+            leds->pending[bank] = send_command(maschine, command, MASCHINE_LED_CMD_SIZE);
+            leds->dirty[bank] = leds->pending[bank] == NULL;
+        }
+        
+        else if (!command_is_in_flight(maschine, ep1_command_class(EP1_CMD_DIMM_LEDS), pending)) {
+            memcpy(pending->buffer, command, MASCHINE_LED_CMD_SIZE);
+            leds->dirty[bank] = 0;
+        }
+        
+        /* else the bank is on the wire, it'll be resent once acknowledged */
+    }
+}
+
+static void led_engine_transfer_done(struct Maschine *maschine, struct Buffer *buffer, int ok) {
+    struct led_engine *leds = &maschine->leds;
+    
+    for (int bank = 0; bank < 2; bank++) {
+        if (buffer == NULL || leds->pending[bank] != buffer)
+            continue;
+        
+        leds->pending[bank] = NULL;
+        
+        if (!ok)
+            leds->dirty[bank] = 1;
+    }
+}
+
+/*
+static void send_command_dimm_leds(
+   libusb_device_handle * maschine,
+   int bank
+) {
+    uint8_t command[MASCHINE_LED_BANK_SIZE + 2] = {0};
+    
+    command[0] = EP1_CMD_DIMM_LEDS;
+    command[1] = bank ? 0x1e : 0x00;
+    
+    static int i = 0;
+    command[2 + i] = MASCHINE_LED_MAX_VAL;
+    
+    if (bank)
+        i = (i + 1) % MASCHINE_LED_BANK_SIZE;
+    
+    send_command(maschine, command, sizeof(command));
+}
+*/
+
+void receive_ep1_command_responses(struct Maschine *maschine) {
+    InEndpoint_Start(
+        &maschine->ep1_command_responses,
+        &maschine->driver->stats.ep1_in,
+        DRIVER_LATENCY_EP1_IN,
+        maschine->usb_handle,
+        0x81,
+        &maschine->ep1_command_response_buffers[0][0],
+        EP1_RESPONSE_TRANSFER_LENGTH,
+        ep1_command_responses_callback,
+        maschine
+    );
+}
+
+void receive_ep4_pad_pressure_report(struct Maschine *maschine) {
+    InEndpoint_Start(
+        &maschine->ep4_pad_reports,
+        &maschine->driver->stats.ep4_in,
+        DRIVER_LATENCY_EP4_IN,
+        maschine->usb_handle,
+        0x84,
+        &maschine->ep4_pad_report_buffers[0][0],
+        EP4_RESPONSE_TRANSFER_LENGTH,
+        ep4_pad_pressure_report_transfer_callback,
+        maschine
+    );
+}
+
+static void send_display_async_callback(struct libusb_transfer *transfer);
+static void display_present_pending(struct Maschine *maschine);
+
+static void send_display_async(struct Maschine * maschine) {
+    TransferWindow_Fill(
+        &maschine->ep8_display_window,
+        &maschine->display_queue,
+        maschine->usb_handle,
+        0x08,
+        send_display_async_callback,
+        maschine
+    );
+}
+
+static void send_display_async_callback(struct libusb_transfer *transfer) {
+    struct Maschine *maschine = (struct Maschine *)transfer->user_data;
+    
+    Maschine_TransferCompleted(transfer);
+    
+    uint64_t submitted_at = TransferWindow_Completed(&maschine->ep8_display_window);
+    
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+        driver_stats_record(&maschine->driver->counters, DRIVER_LATENCY_EP8_OUT, monotonic_now_ns() - submitted_at);
+    
+    maschine->driver->stats.ep8_bytes += transfer->actual_length;
+
+    BufferQueue_Remove(&maschine->display_queue);
+    
+    send_display_async(maschine);
+    display_present_pending(maschine);
+}
+
+/* both return NULL if the queue is full and the command was dropped */
+static struct Buffer * send_display(struct Maschine * maschine, uint8_t *buffer, int len) {
+    struct Buffer *queued = BufferQueue_Add(&maschine->display_queue, buffer, len);
+    
+    driver_stats_queue_depth(&maschine->driver->counters, DRIVER_QUEUE_DISPLAY, BufferQueue_Count(&maschine->display_queue));
+    send_display_async(maschine);
+    
+    return queued;
+}
+
+static struct Buffer * send_display_reference(struct Maschine * maschine, uint8_t *buffer, int len, int *references) {
+    struct Buffer *queued = BufferQueue_AddReference(&maschine->display_queue, buffer, len, references);
+    
+    driver_stats_queue_depth(&maschine->driver->counters, DRIVER_QUEUE_DISPLAY, BufferQueue_Count(&maschine->display_queue));
+    send_display_async(maschine);
+    
+    return queued;
+}
+
+static void display_init_1(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init1[]  = {d, 0x00, 0x01, 0x30};
+    uint8_t init2[]  = {d, 0x00, 0x04, 0xCA, 0x04, 0x0F, 0x00};
+    
+    send_display(maschine, init1,  sizeof(init1));
+    send_display(maschine, init2,  sizeof(init2));
+}
+
+static void display_init_2(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init3[]  = {d, 0x00, 0x02, 0xBB, 0x00};
+    uint8_t init4[]  = {d, 0x00, 0x01, 0xD1};
+    uint8_t init5[]  = {d, 0x00, 0x01, 0x94};
+    uint8_t init6[]  = {d, 0x00, 0x03, 0x81, 0x1E, 0x02};
+    
+    send_display(maschine, init3,  sizeof(init3));
+    send_display(maschine, init4,  sizeof(init4));
+    send_display(maschine, init5,  sizeof(init5));
+    send_display(maschine, init6,  sizeof(init6));
+}
+
+static void display_init_3(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init7[]  = {d, 0x00, 0x02, 0x20, 0x08};
+    send_display(maschine, init7,  sizeof(init7));
+}
+
+static void display_init_4(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init8[]  = {d, 0x00, 0x02, 0x20, 0x0B};
+    send_display(maschine, init8,  sizeof(init8));
+}
+
+static void display_init_5(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init9[]  = {d, 0x00, 0x01, 0xA6};
+    uint8_t init10[] = {d, 0x00, 0x01, 0x31};
+    uint8_t init11[] = {d, 0x00, 0x04, 0x32, 0x00, 0x00, 0x05};
+    uint8_t init12[] = {d, 0x00, 0x01, 0x34};
+    uint8_t init13[] = {d, 0x00, 0x01, 0x30};
+    uint8_t init14[] = {d, 0x00, 0x04, 0xBC, 0x00, 0x01, 0x02};
+    uint8_t init15[] = {d, 0x00, 0x03, 0x75, 0x00, 0x3F};
+    uint8_t init16[] = {d, 0x00, 0x03, 0x15, 0x00, 0x54};
+    uint8_t init17[] = {d, 0x00, 0x01, 0x5C};
+    uint8_t init18[] = {d, 0x00, 0x01, 0x25};
+    
+    send_display(maschine, init9,  sizeof(init9));
+    send_display(maschine, init10, sizeof(init10));
+    send_display(maschine, init11, sizeof(init11));
+    send_display(maschine, init12, sizeof(init12));
+    send_display(maschine, init13, sizeof(init13));
+    send_display(maschine, init14, sizeof(init14));
+    send_display(maschine, init15, sizeof(init15));
+    send_display(maschine, init16, sizeof(init16));
+    send_display(maschine, init17, sizeof(init17));
+    send_display(maschine, init18, sizeof(init18));
+}
+
+static void display_init_6(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init19[] = {d, 0x00, 0x01, 0xAF};
+    send_display(maschine, init19, sizeof(init19));
+}
+
+static void display_init_7(struct Maschine *maschine, enum MaschineDisplay d) {
+    uint8_t init20[] = {d, 0x00, 0x04, 0xBC, 0x02, 0x01, 0x01};
+    uint8_t init21[] = {d, 0x00, 0x01, 0xA6};
+    uint8_t init22[] = {d, 0x00, 0x03, 0x81, 0x25, 0x02};
+    
+    send_display(maschine, init20, sizeof(init20));
+    send_display(maschine, init21, sizeof(init21));
+    send_display(maschine, init22, sizeof(init22));
+}
+
+static struct display_framebuffer * display_framebuffer_for(struct Maschine *maschine, enum MaschineDisplay display) {
+    return &maschine->displays[display >> 1];
+}
+
+static uint8_t * display_framebuffer_row(struct display_framebuffer *fb, int row) {
+    return fb->pixels + row * display_row_size;
+}
+
+static uint8_t * display_row(struct Maschine *maschine, enum MaschineDisplay display, int row) {
+    return display_framebuffer_row(display_framebuffer_for(maschine, display), row);
+}
+
+/* finds the rows that differ from what the display is showing, returns
+ * zero if there's nothing to send
+ */
+static int display_changed_rows(
+    struct display_framebuffer *fb,
+    int *first_row,
+    int *last_row
+) {
+    int first = 0;
+    int last  = display_height - 1;
+    
+    if (fb->shadow_valid) {
+        while (first <= last && memcmp(fb->shadow + first * display_row_size, display_framebuffer_row(fb, first), display_row_size) == 0)
+            first++;
+        
+        if (first > last)
+            return 0;
+        
+        while (memcmp(fb->shadow + last * display_row_size, display_framebuffer_row(fb, last), display_row_size) == 0)
+            last--;
+    }
+    
+    *first_row = first;
+    *last_row  = last;
+    return 1;
+}
+
+static void display_present(struct Maschine *maschine, enum MaschineDisplay display) {
+    struct display_framebuffer *fb = display_framebuffer_for(maschine, display);
+    
+    uint8_t d = display;
+    
+    int first_row;
+    int last_row;
+    int queued = 1;
+    
+    /* the slices of the last frame are still owned by libusb, the rows
+     * that changed are sent once they are back
+     */
+    if (fb->slices_in_flight != 0) {
+        fb->present_pending = 1;
+        return;
+    }
+    
+    fb->present_pending = 0;
+    
+    if (!display_changed_rows(fb, &first_row, &last_row))
+        return;
+    
+    uint8_t set_rows[]    = { d, 0x00, 0x03, 0x75, first_row, last_row };
+    uint8_t set_columns[] = { d, 0x00, 0x03, 0x15, 0x00,      0x54     };
+    
+    queued &= send_display(maschine, set_rows,    sizeof(set_rows))    != NULL;
+    queued &= send_display(maschine, set_columns, sizeof(set_columns)) != NULL;
+    
+    /* the first slice carries the write memory command (0x5c) before its
+     * pixels and uses the whole header room, the following ones are
+     * flagged as continuation (d + 1) and use only the last 3 bytes
+     */
+    
+    const uint8_t *pixels = display_framebuffer_row(fb, first_row);
+    int remaining = (last_row - first_row + 1) * display_row_size;
+    
+    for (int s = 0; remaining > 0; s++) {
+        int size = remaining < display_slice_size ? remaining : display_slice_size;
+        uint8_t *slice = fb->slices[s];
+        int len;
+        
+        if (s == 0) {
+            len      = size + 1;
+            slice[0] = d;
+            slice[3] = 0x5c;
+            memcpy(slice + 4, pixels, size);
+        }
+        else {
+            len      = size;
+            slice   += 1;
+            slice[0] = d + 1;
+            memcpy(slice + 3, pixels, size);
+        }
+        
+        slice[1] = (len >> 8) & 0xff;
+        slice[2] = (len >> 0) & 0xff;
+        
+        queued &= send_display_reference(maschine, slice, len + 3, &fb->slices_in_flight) != NULL;
+        
+        pixels    += size;
+        remaining -= size;
+    }
+    
+    /* with a command dropped the display isn't showing what we sent, the
+     * next frame goes out whole
+     */
+    if (!queued) {
+        fb->shadow_valid = 0;
+        return;
+    }
+    
+    memcpy(
+        fb->shadow + first_row * display_row_size,
+        display_framebuffer_row(fb, first_row),
+        (last_row - first_row + 1) * display_row_size
+    );
+    
+    fb->shadow_valid = 1;
+}
+
+static void display_present_pending(struct Maschine *maschine) {
+    if (maschine->closing)
+        return;
+    
+    for (int i = 0; i < 2; i++) {
+        enum MaschineDisplay display = i ? MaschineDisplay_Right : MaschineDisplay_Left;
+        struct display_framebuffer *fb = display_framebuffer_for(maschine, display);
+        
+        if (fb->present_pending && fb->slices_in_flight == 0)
+            display_present(maschine, display);
+    }
+}
+
+static void display_draw_test_pattern(struct Maschine *maschine, enum MaschineDisplay d) {
+    // 0x  f8        1f
+    //     1111 1000 0001 1111
+    // 0x  07        c0
+    //     0000 0111 1100 0000
+    
+    for (int row = 0; row < display_height; row++) {
+        uint8_t *data = display_row(maschine, d, row);
+        int xx = 0x00;
+        
+        for (int i = 0; i < display_row_size; i++) {
+            if ((i % 2) == 0) {
+                data[i] = (xx << 3) | (xx >> 2);
+            }
+            else {
+                data[i] = (xx << 6) | (xx);
+            }
+            
+            xx = (xx + 1) & 0x1f;
+        }
+    }
+}
+
+static void display_send_test_pattern(struct Maschine *maschine, enum MaschineDisplay d) {
+    /* applications using the driver as a library draw their own frames */
+    if (!maschine->driver->config.demo)
+        return;
+    
+    display_draw_test_pattern(maschine, d);
+    display_present(maschine, d);
+}
+
+/* here we assume that one "tick" (1/30th of a sec) is enough
+ * to transfer a single init step
+ */
+
+typedef void (*display_init_step)(struct Maschine *, enum MaschineDisplay);
+
+static const display_init_step display_init_steps[] = {
+    display_init_1,
+    display_init_2,
+    display_init_3,
+    display_init_4,
+    display_init_5,
+    display_init_6,
+    display_init_7,
+    display_send_test_pattern,
+};
+
+enum { display_init_steps_count = sizeof(display_init_steps) / sizeof(display_init_step) };
+
+static int display_ready(struct Maschine *maschine) {
+    return maschine->display_init_state >= display_init_steps_count;
+}
+
+static void display_init_tick(struct Maschine *maschine) {
+    if (display_ready(maschine)) {
+        return;
+    }
+    
+    display_init_steps[maschine->display_init_state](maschine, MaschineDisplay_Left);
+    display_init_steps[maschine->display_init_state](maschine, MaschineDisplay_Right);
+    maschine->display_init_state++;
+}
+
+/* - */
+
+/* the host requests ring has a single producer: the MIDI backend thread
+ * running Maschine_ReceiveHostMidi
+ */
+static void Maschine_PostHostRequest(struct Maschine *maschine, const uint8_t *data, int len) {
+    struct HostRequest *request = spsc_ring_reserve(&maschine->host_requests);
+    
+    /* the ring counts the overflow, there's nothing better to do from a
+     * real time thread than dropping the request
+     */
+    if (request == NULL)
+        return;
+    
+    request->len = len;
+    request->received_at = monotonic_now_ns();
+    memcpy(request->data, data, len);
+    
+    spsc_ring_commit(&maschine->host_requests);
+}
+
+static void Maschine_ReceiveHostMidi(const uint8_t *buf, int len, void *user_data) {
+    struct Maschine *maschine = (struct Maschine *)user_data;
+    
+    while (len > 0) {
+        int chunk = len < HOST_REQUEST_DATA_SIZE ? len : HOST_REQUEST_DATA_SIZE;
+        Maschine_PostHostRequest(maschine, buf, chunk);
+        
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+static void Maschine_ProcessHostRequests(void *user_data) {
+    struct Maschine *maschine = (struct Maschine *)user_data;
+    struct HostRequest *request;
+    
+    spsc_ring_clear_wakeup(&maschine->host_requests);
+    
+    while ((request = spsc_ring_peek(&maschine->host_requests)) != NULL) {
+        send_command_midi_write(maschine, request->data, request->len, request->received_at);
+        spsc_ring_release(&maschine->host_requests);
+    }
+}
+
+/* buf holds one or more complete messages, they go to the host together */
+static void midi_send(uint8_t *buf, int len, void *user_data) {
+    struct Maschine * maschine = (struct Maschine *)user_data;
+    maschine_driver_config *config = &maschine->driver->config;
+    
+    /* late completions of a unit that has been unplugged */
+    if (maschine->closing)
+        return;
+    
+    if (maschine->midi)
+        config->host_midi->send(maschine->midi, maschine->midi_timestamp, buf, len);
+    
+    if (config->midi)
+        config->midi(maschine->driver, maschine->index, maschine->midi_timestamp, buf, len, config->user_data);
+    
+    maschine->midi_pending = 1;
+}
+
+static void midi_flush(struct Maschine * maschine) {
+    if (maschine->closing || !maschine->midi_pending)
+        return;
+    
+    if (maschine->midi)
+        maschine->driver->config.host_midi->flush(maschine->midi);
+    
+    maschine->midi_pending = 0;
+    
+    driver_stats_record(&maschine->driver->counters, maschine->midi_source, monotonic_now_ns() - maschine->midi_timestamp);
+}
+
+/* real time messages don't wait for the rest of the transfer */
+static void midi_send_realtime(uint8_t *buf, int len, void *user_data) {
+    struct Maschine * maschine = (struct Maschine *)user_data;
+    
+    midi_send(buf, len, user_data);
+    midi_flush(maschine);
+}
+
+/*
+static void send_display_test(struct Maschine * maschine) {
+    MaschineDisplayData display_data;
+    display_data_test(display_data);
+    
+    display_init(maschine, MaschineDisplay_Left);
+    display_init(maschine, MaschineDisplay_Right);
+    
+    display_send_frame(maschine, display_data, MaschineDisplay_Left);
+    display_send_frame(maschine, display_data, MaschineDisplay_Right);
+}
+*/
+
+static void led_show_init(struct Maschine *maschine) {
+    struct led_show_state *state = &maschine->led_show;
+    
+    state->num_pads = 16;
+    state->show_pads = 0;
+    
+    led_engine_set_led(&maschine->leds, MaschineLed_BacklightDisplay, 1);
+}
+
+static void led_show_tick(struct Maschine *maschine) {
+    struct led_show_state *state = &maschine->led_show;
+    
+    int onoff = !(state->show_pads / state->num_pads);
+    int pad   =   state->show_pads % state->num_pads;
+    
+    led_engine_set_led(&maschine->leds, MaschineLed_Pad_1 + pad, onoff);
+    
+    state->show_pads++;
+    
+    if (state->show_pads > (state->num_pads * 2))
+        state->show_pads = 0;
+}
+
+static void Maschine_CloseHost(struct Maschine * maschine) {
+    if (maschine->midi)
+        maschine->driver->config.host_midi->close(maschine->midi);
+    
+    spsc_ring_destroy(&maschine->host_requests);
+}
+
+/* everything that doesn't need the device or the host */
+static void Maschine_InitState(struct Maschine * maschine, struct maschine_driver *driver, int index) {
+    memset(maschine, 0, sizeof(struct Maschine));
+    
+    maschine->driver = driver;
+    maschine->index = index;
+    
+    maschine->ep1_command_window.size = driver->config.transfer_window;
+    maschine->ep8_display_window.size = driver->config.transfer_window;
+    maschine->ep1_command_window.counters    = &driver->counters;
+    maschine->ep8_display_window.counters    = &driver->counters;
+    maschine->ep1_command_responses.counters = &driver->counters;
+    maschine->ep4_pad_reports.counters       = &driver->counters;
+    
+    midi_parser_init(&maschine->parser, midi_send, maschine);
+    midi_parser_set_batch_callback(&maschine->parser, midi_send);
+    midi_parser_set_realtime_callback(&maschine->parser, midi_send_realtime);
+    pad_engine_init(&maschine->pads, midi_send, maschine);
+    pad_engine_set_config(&maschine->pads, &driver->pads);
+    erp_decoder_init(&maschine->erps, midi_send, maschine);
+    button_decoder_init(&maschine->buttons, midi_send, maschine);
+    
+    BufferQueue_Init(
+        &maschine->command_queues[Ep1Class_Midi],
+        maschine->midi_queue_buffers,
+        &maschine->midi_queue_storage[0][0],
+        EP1_MIDI_QUEUE_SIZE,
+        EP1_COMMAND_SLOT_SIZE
+    );
+    
+    BufferQueue_Init(
+        &maschine->command_queues[Ep1Class_Control],
+        maschine->control_queue_buffers,
+        &maschine->control_queue_storage[0][0],
+        EP1_CONTROL_QUEUE_SIZE,
+        EP1_COMMAND_SLOT_SIZE
+    );
+    
+    BufferQueue_Init(
+        &maschine->command_queues[Ep1Class_Leds],
+        maschine->leds_queue_buffers,
+        &maschine->leds_queue_storage[0][0],
+        EP1_LEDS_QUEUE_SIZE,
+        EP1_COMMAND_SLOT_SIZE
+    );
+    
+    BufferQueue_Init(
+        &maschine->display_queue,
+        maschine->display_queue_buffers,
+        &maschine->display_queue_storage[0][0],
+        EP8_DISPLAY_QUEUE_SIZE,
+        EP8_DISPLAY_SLOT_SIZE
+    );
+    
+    for (int class = 0; class < EP1_CLASS_COUNT; class++)
+        maschine->command_queues[class].counters = &driver->counters;
+    
+    maschine->display_queue.counters = &driver->counters;
+    
+    led_engine_init(&maschine->leds);
+}
+
+static void Maschine_FreeTransfers(struct Maschine * maschine) {
+    InEndpoint_Free(&maschine->ep1_command_responses);
+    InEndpoint_Free(&maschine->ep4_pad_reports);
+    TransferWindow_Free(&maschine->ep1_command_window);
+    TransferWindow_Free(&maschine->ep8_display_window);
+}
+
+/* everything that allocates or may block: the state, the host ports, the
+ * interface and the transfers. Nothing is submitted yet, see
+ * Maschine_Start. device_handle is NULL for a unit replaying a trace,
+ * it's left to the caller to close if this fails
+ */
+static struct Maschine *Maschine_Open(
+    struct maschine_driver *driver,
+    libusb_device_handle *device_handle,
+    int index
+) {
+    const midi_backend *host_midi = driver->config.host_midi;
+    int r;
+    
+    struct Maschine *maschine = malloc(sizeof(struct Maschine));
+    
+    if (maschine == NULL) {
+        driver_log("cannot allocate the maschine state\n");
+        return NULL;
+    }
+
+    Maschine_InitState(maschine, driver, index);
+    
+    maschine->replaying = device_handle == NULL;
+    
+    /* the ring must be ready before the backend can call Maschine_ReceiveHostMidi */
+    r = spsc_ring_init(
+        &maschine->host_requests,
+        maschine->host_requests_storage,
+        HOST_REQUESTS_RING_SIZE,
+        sizeof(struct HostRequest)
+    );
+    
+    if (r != 0) {
+        driver_log("cannot create host requests ring\n");
+        free(maschine);
+        return NULL;
+    }
+    
+    if (host_midi) {
+        maschine->midi = host_midi->open(
+            "Simple Maschine MIDI",
+            index,
+            Maschine_ReceiveHostMidi,
+            maschine
+        );
+        
+        if (maschine->midi == NULL) {
+            driver_log("cannot create the %s ports\n", host_midi->name);
+            spsc_ring_destroy(&maschine->host_requests);
+            free(maschine);
+            return NULL;
+        }
+    }
+
+    /* - */
+
+    if (device_handle) {
+        r = libusb_claim_interface(device_handle, 0);
+        if (r != LIBUSB_SUCCESS) {
+            driver_log("cannot claim interface %d\n", r);
+            Maschine_CloseHost(maschine);
+            free(maschine);
+            return NULL;
+        }
+        
+        r = libusb_set_interface_alt_setting(device_handle, 0, 1);
+        if (r != LIBUSB_SUCCESS) {
+            driver_log("cannot set alternate interface %d\n", r);
+            Maschine_CloseHost(maschine);
+            free(maschine);
+            return NULL;
+        }
+    }
+
+    if (InEndpoint_Alloc(&maschine->ep1_command_responses) != 0 ||
+        InEndpoint_Alloc(&maschine->ep4_pad_reports) != 0 ||
+        TransferWindow_Alloc(&maschine->ep1_command_window) != 0 ||
+        TransferWindow_Alloc(&maschine->ep8_display_window) != 0) {
+        driver_log("cannot allocate the transfers\n");
+        Maschine_FreeTransfers(maschine);
+        Maschine_CloseHost(maschine);
+        free(maschine);
+        return NULL;
+    }
+    
+    maschine->usb_handle = device_handle;
+    
+    return maschine;
+}
+
+/* submits the first transfers of an opened unit, from the event thread */
+static void Maschine_Start(struct Maschine * maschine) {
+    event_loop_add_fd(
+        &maschine->driver->loop,
+        spsc_ring_wakeup_fd(&maschine->host_requests),
+        POLLIN,
+        Maschine_ProcessHostRequests,
+        maschine
+    );
+    
+    receive_ep1_command_responses(maschine);
+    receive_ep4_pad_pressure_report(maschine);
+    
+    send_command_get_device_info(maschine);
+    send_command_set_auto_message(maschine, 1, 10, 5);
+    
+    /* - */
+        
+    if (maschine->driver->config.demo)
+        led_show_init(maschine);
+}
+
+/* cancels everything in flight. The transfers still belong to libusb until
+ * their callbacks have run, so the handle is closed and the memory released
+ * later, by maschines_tick
+ */
+static void Maschine_disconnect(struct Maschine * maschine) {
+    maschine_driver_config *config = &maschine->driver->config;
+    
+    maschine->closing = 1;
+    
+    /* the host ports stay open until the unit is released, midi_send
+     * ignores a closing unit
+     */
+    event_loop_remove_fd(&maschine->driver->loop, spsc_ring_wakeup_fd(&maschine->host_requests));
+
+    if (maschine->replaying) {
+        /* nothing was really submitted, so nothing comes back */
+        maschine->ep1_command_responses.cancelled = 1;
+        maschine->ep1_command_responses.queued = 0;
+        maschine->ep4_pad_reports.cancelled = 1;
+        maschine->ep4_pad_reports.queued = 0;
+        maschine->ep1_command_window.cancelled = 1;
+        maschine->ep1_command_window.in_flight = 0;
+        maschine->ep8_display_window.cancelled = 1;
+        maschine->ep8_display_window.in_flight = 0;
+    }
+    else {
+        InEndpoint_Cancel(&maschine->ep1_command_responses);
+        InEndpoint_Cancel(&maschine->ep4_pad_reports);
+        TransferWindow_Cancel(&maschine->ep1_command_window);
+        TransferWindow_Cancel(&maschine->ep8_display_window);
+    }
+    
+    if (config->unit)
+        config->unit(maschine->driver, maschine->index, 0, config->user_data);
+}
+
+static int Maschine_TransfersOutstanding(struct Maschine * maschine) {
+    return
+        maschine->ep1_command_window.in_flight +
+        maschine->ep8_display_window.in_flight +
+        maschine->ep1_command_responses.queued +
+        maschine->ep4_pad_reports.queued;
+}
+
+/* undoes Maschine_Open, once libusb has handed back every transfer */
+static void Maschine_Free(struct Maschine * maschine) {
+    Maschine_CloseHost(maschine);
+    Maschine_FreeTransfers(maschine);
+    
+    if (maschine->usb_handle)
+        libusb_close(maschine->usb_handle);
+    
+    free(maschine);
+}
+
+static void Maschine_Tick(struct Maschine * maschine) {
+    display_init_tick(maschine);
+    
+    if (maschine->driver->config.demo)
+        led_show_tick(maschine);
+    
+    led_engine_flush(maschine);
+}
+
+/* - */
+
+static struct Maschine *maschines_find(struct maschine_driver *driver, libusb_device *dev) {
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        struct Maschine *maschine = driver->maschines[i];
+        
+        if (maschine && !maschine->closing && !maschine->replaying &&
+            libusb_get_device(maschine->usb_handle) == dev)
+            return maschine;
+    }
+    
+    return NULL;
+}
+
+/* the slot of the device if the lifecycle thread is opening it, or -1 */
+static int maschines_opening(struct maschine_driver *driver, libusb_device *dev) {
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        if (driver->opening[i] == dev)
+            return i;
+    }
+    
+    return -1;
+}
+
+static int maschines_free_slot(struct maschine_driver *driver) {
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        if (driver->maschines[i] == NULL && driver->opening[i] == NULL)
+            return i;
+    }
+    
+    return -1;
+}
+
+/* the unit with that number, if it's attached and not being released */
+static struct Maschine *maschines_unit(struct maschine_driver *driver, int unit) {
+    if (unit < 0 || unit >= MASCHINES_MAX)
+        return NULL;
+    
+    struct Maschine *maschine = driver->maschines[unit];
+    
+    return maschine && !maschine->closing ? maschine : NULL;
+}
+
+/* an opened unit takes its slot and starts */
+static void maschines_start(struct maschine_driver *driver, struct Maschine *maschine) {
+    int index = maschine->index;
+    
+    driver->maschines[index] = maschine;
+    Maschine_Start(maschine);
+    
+    driver_log(
+        "maschine %d %s, %zu bytes of state\n",
+        index + 1,
+        maschine->replaying ? "replaying" : "connected",
+        sizeof(struct Maschine)
+    );
+    
+    if (driver->config.unit)
+        driver->config.unit(driver, index, 1, driver->config.user_data);
+}
+
+/* a new unit on the device, or fed from a trace if handle is NULL, opened
+ * right away on the calling thread
+ */
+static struct Maschine *maschines_attach(struct maschine_driver *driver, libusb_device_handle *handle) {
+    int index = maschines_free_slot(driver);
+    
+    if (index < 0)
+        return NULL;
+    
+    struct Maschine *maschine = Maschine_Open(driver, handle, index);
+    
+    if (maschine == NULL) {
+        driver_log("cannot connect to the maschine\n");
+        return NULL;
+    }
+    
+    maschines_start(driver, maschine);
+    
+    return maschine;
+}
+
+/* hands the device to the lifecycle thread, the unit is started once it
+ * comes back opened, see maschines_lifecycle_done
+ */
+static void maschines_open_later(struct maschine_driver *driver, libusb_device *dev) {
+    int index = maschines_free_slot(driver);
+    struct LifecycleRequest *request = spsc_ring_reserve(&driver->lifecycle_requests);
+    
+    if (request == NULL) {
+        driver_log("not attaching to device because too many are being opened\n");
+        return;
+    }
+    
+    request->kind = LifecycleRequest_Open;
+    request->index = index;
+    request->device = libusb_ref_device(dev);
+    request->maschine = NULL;
+    
+    driver->opening[index] = dev;
+    driver->opening_left[index] = 0;
+    
+    spsc_ring_commit(&driver->lifecycle_requests);
+}
+
+/* a unit that has been stopped and has nothing in flight anymore */
+static void maschines_release(struct maschine_driver *driver, struct Maschine *maschine) {
+    struct LifecycleRequest *request = NULL;
+    
+    if (driver->lifecycle_running)
+        request = spsc_ring_reserve(&driver->lifecycle_requests);
+    
+    if (request == NULL) {
+        Maschine_Free(maschine);
+        return;
+    }
+    
+    request->kind = LifecycleRequest_Release;
+    request->index = maschine->index;
+    request->device = NULL;
+    request->maschine = maschine;
+    
+    spsc_ring_commit(&driver->lifecycle_requests);
+}
+
+/* the units the lifecycle thread has opened, or failed to */
+static void maschines_lifecycle_done(void *user_data) {
+    struct maschine_driver *driver = (struct maschine_driver *)user_data;
+    struct LifecycleRequest *done;
+    
+    spsc_ring_clear_wakeup(&driver->lifecycle_done);
+    
+    while ((done = spsc_ring_peek(&driver->lifecycle_done)) != NULL) {
+        struct Maschine *maschine = done->maschine;
+        int index = done->index;
+        int left = driver->opening_left[index];
+        
+        spsc_ring_release(&driver->lifecycle_done);
+        
+        driver->opening[index] = NULL;
+        driver->opening_left[index] = 0;
+        
+        if (maschine == NULL)
+            continue;
+        
+        if (left) {
+            driver_log("maschine %d unplugged while being opened\n", index + 1);
+            maschines_release(driver, maschine);
+            continue;
+        }
+        
+        maschines_start(driver, maschine);
+    }
+}
+
+static void lifecycle_open(struct maschine_driver *driver, struct LifecycleRequest *request) {
+    libusb_device_handle *handle;
+    struct Maschine *maschine = NULL;
+    
+    int rc = libusb_open(request->device, &handle);
+    
+    if (LIBUSB_SUCCESS != rc) {
+        driver_log("Could not open USB device\n");
+    }
+    else {
+        maschine = Maschine_Open(driver, handle, request->index);
+        
+        if (maschine == NULL) {
+            driver_log("cannot connect to the maschine\n");
+            libusb_close(handle);
+        }
+    }
+    
+    /* the handle keeps its own reference */
+    libusb_unref_device(request->device);
+    
+    /* there's always room, every open has its slot reserved until the
+     * event thread takes the result
+     */
+    struct LifecycleRequest *done = spsc_ring_reserve(&driver->lifecycle_done);
+    
+    done->kind = LifecycleRequest_Open;
+    done->index = request->index;
+    done->device = NULL;
+    done->maschine = maschine;
+    
+    spsc_ring_commit(&driver->lifecycle_done);
+}
+
+/* opens and releases units for the event thread, at normal priority */
+static void *lifecycle_thread_main(void *user_data) {
+    struct maschine_driver *driver = user_data;
+    sigset_t signals;
+    
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    while (1) {
+        struct LifecycleRequest *next = spsc_ring_peek(&driver->lifecycle_requests);
+        
+        if (next == NULL) {
+            struct pollfd pfd = { spsc_ring_wakeup_fd(&driver->lifecycle_requests), POLLIN, 0 };
+            
+            spsc_ring_clear_wakeup(&driver->lifecycle_requests);
+            
+            if (spsc_ring_peek(&driver->lifecycle_requests) == NULL)
+                poll(&pfd, 1, -1);
+            
+            continue;
+        }
+        
+        struct LifecycleRequest request = *next;
+        spsc_ring_release(&driver->lifecycle_requests);
+        
+        switch (request.kind) {
+            case LifecycleRequest_Open:
+                lifecycle_open(driver, &request);
+                break;
+                
+            case LifecycleRequest_Release:
+                Maschine_Free(request.maschine);
+                break;
+                
+            case LifecycleRequest_Quit:
+                return NULL;
+        }
+    }
+}
+
+/* replaying units take what they send right away */
+static void maschines_replay_out(struct maschine_driver *driver) {
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        struct Maschine *maschine = driver->maschines[i];
+        
+        if (maschine == NULL || !maschine->replaying || maschine->closing)
+            continue;
+        
+        TransferWindow_Replay(&maschine->ep1_command_window);
+        TransferWindow_Replay(&maschine->ep8_display_window);
+    }
+}
+
+static void maschines_tick(struct maschine_driver *driver) {
+    int devices = 0;
+    
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        struct Maschine *maschine = driver->maschines[i];
+        
+        if (maschine == NULL)
+            continue;
+        
+        if (maschine->closing) {
+            if (Maschine_TransfersOutstanding(maschine) == 0) {
+                driver->maschines[i] = NULL;
+                maschines_release(driver, maschine);
+                driver_log("maschine %d released\n", i + 1);
+            }
+            
+            continue;
+        }
+        
+        Maschine_Tick(maschine);
+        devices++;
+    }
+    
+    driver->stats.devices = devices;
+}
+
+/* a full capture drops every record until it's closed, this says so
+ * while it happens, at most once a second
+ */
+static void capture_tick(struct maschine_driver *driver, uint64_t now) {
+    if (driver->trace == NULL || now < driver->capture_next_report)
+        return;
+    
+    uint64_t dropped = driver->trace->header->dropped;
+    
+    if (dropped == driver->capture_dropped_reported)
+        return;
+    
+    driver_log(
+        "capture full, %llu records dropped so far\n",
+        (unsigned long long)dropped
+    );
+    
+    driver->capture_dropped_reported = dropped;
+    driver->capture_next_report = now + 1000000000ull;
+}
+
+static int hotplug_callback(
+    struct libusb_context *ctx,
+    struct libusb_device *dev,
+    libusb_hotplug_event event,
+    void *user_data
+) {
+    struct maschine_driver *driver = (struct maschine_driver *)user_data;
+    int rc;
+    struct Maschine *maschine;
+    
+    /*{
+        struct libusb_device_descriptor desc;
+        libusb_get_device_descriptor(dev, &desc);
+    }*/
+    
+    switch (event) {
+        case LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED:
+            driver_log("LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED: ctx: %p dev: %p\n", ctx, dev);
+            
+            if (maschines_find(driver, dev) || maschines_opening(driver, dev) >= 0) {
+                driver_log("not attaching to device because already connected to it\n");
+                break;
+            }
+            
+            if (maschines_free_slot(driver) < 0) {
+                driver_log("not attaching to device because %d are already connected\n", MASCHINES_MAX);
+                break;
+            }
+            
+            if (driver->lifecycle_running) {
+                maschines_open_later(driver, dev);
+                break;
+            }
+            
+            libusb_device_handle *handle;
+            rc = libusb_open(dev, &handle);
+            
+            if (LIBUSB_SUCCESS != rc) {
+                driver_log("Could not open USB device\n");
+                break;
+            }
+            
+            if (maschines_attach(driver, handle) == NULL)
+                libusb_close(handle);
+            
+            break;
+            
+        case LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT:
+            driver_log("LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT: ctx: %p dev: %p\n", ctx, dev);
+            
+            maschine = maschines_find(driver, dev);
+            
+            if (maschine == NULL && maschines_opening(driver, dev) >= 0) {
+                driver->opening_left[maschines_opening(driver, dev)] = 1;
+                break;
+            }
+            
+            if (maschine == NULL) {
+                driver_log("not detaching a device because it's not one we're attached to\n");
+                break;
+            }
+            
+            Maschine_disconnect(maschine);
+            
+            break;
+            
+        default:
+            driver_log("Unhandled event %d\n", event);
+            break;
+    }
+    
+    return 0;
+}
+
+/* - */
+
+static int event_loop_init(struct EventLoop *loop, libusb_context *usb) {
+    memset(loop, 0, sizeof(struct EventLoop));
+    
+#if defined(__linux__)
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    loop->fd = kqueue();
+#endif
+    
+    if (loop->fd < 0) {
+        driver_log("cannot create the event loop descriptor: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    const struct libusb_pollfd **pollfds = libusb_get_pollfds(usb);
+    
+    if (pollfds) {
+        for (int i = 0; pollfds[i] != NULL; i++) {
+            event_loop_pollfd_added(pollfds[i]->fd, pollfds[i]->events, loop);
+        }
+        
+        libusb_free_pollfds(pollfds);
+    }
+    
+    libusb_set_pollfd_notifiers(
+        usb,
+        event_loop_pollfd_added,
+        event_loop_pollfd_removed,
+        loop
+    );
+    
+    loop->next_tick = monotonic_now_ns() + TICK_INTERVAL_NS;
+    
+    return 0;
+}
+
+static uint64_t event_loop_next_deadline(struct EventLoop *loop, libusb_context *usb, uint64_t now) {
+    uint64_t deadline = loop->next_tick;
+    
+    /* libusb may need to be woken up for its own transfer timeouts if
+     * it cannot express them as file descriptors
+     */
+    
+    struct timeval tv;
+    
+    if (libusb_get_next_timeout(usb, &tv) == 1) {
+        uint64_t usb_deadline = now +
+            (uint64_t)tv.tv_sec  * 1000000000ull +
+            (uint64_t)tv.tv_usec * 1000ull;
+        
+        if (usb_deadline < deadline)
+            deadline = usb_deadline;
+    }
+    
+    return deadline;
+}
+
+static void event_loop_stats_report_in_endpoint(const char *name, struct InEndpointStats *in, uint64_t elapsed) {
+    driver_log(
+        "  %s in: %6.1f callbacks/s  callback avg: %6.1f us  max: %6.1f us  starved: %6.2f ms  resubmit failures: %u\n",
+        name,
+        in->callbacks * 1e9 / elapsed,
+        in->callbacks ? in->callback_ns_sum / in->callbacks / 1000.0 : 0.0,
+        in->callback_ns_max / 1000.0,
+        in->starved_ns / 1e6,
+        in->resubmit_failures
+    );
+    
+    memset(in, 0, sizeof(struct InEndpointStats));
+}
+
+static void event_loop_stats_report(struct EventLoopStats *stats, uint64_t now) {    
+    if (!stats->enabled)
+        return;
+    
+    uint64_t elapsed = now - stats->window_start;
+    
+    if (elapsed < 1000000000ull)
+        return;
+    
+    driver_log(
+        "wakeups/s: %5.1f  dispatches/s: %5.1f  dispatch latency avg: %6.1f us  max: %6.1f us  "
+        "display: %6.1f kB/s\n",
+        stats->wakeups    * 1e9 / elapsed,
+        stats->dispatches * 1e9 / elapsed,
+        stats->dispatches ? stats->dispatch_latency_sum / stats->dispatches / 1000.0 : 0.0,
+        stats->dispatch_latency_max / 1000.0,
+        stats->ep8_bytes * 1e6 / elapsed
+    );
+    
+    event_loop_stats_report_in_endpoint("ep1", &stats->ep1_in, elapsed);
+    event_loop_stats_report_in_endpoint("ep4", &stats->ep4_in, elapsed);
+    
+    driver_log(
+        "  pads: %6.1f messages/s  completion to midi avg: %6.1f us  max: %6.1f us\n",
+        stats->pad_messages * 1e9 / elapsed,
+        stats->pad_reports ? stats->pad_latency_sum / stats->pad_reports / 1000.0 : 0.0,
+        stats->pad_latency_max / 1000.0
+    );
+    
+    driver_log(
+        "  devices: %2d  state: %zu bytes each  tick avg: %6.1f us  max: %6.1f us  per device: %6.1f us\n",
+        stats->devices,
+        sizeof(struct Maschine),
+        stats->ticks ? stats->tick_ns_sum / stats->ticks / 1000.0 : 0.0,
+        stats->tick_ns_max / 1000.0,
+        stats->ticks && stats->devices ? stats->tick_ns_sum / stats->ticks / stats->devices / 1000.0 : 0.0
+    );
+    
+    stats->window_start         = now;
+    stats->wakeups              = 0;
+    stats->dispatches           = 0;
+    stats->dispatch_latency_sum = 0;
+    stats->dispatch_latency_max = 0;
+    stats->ep8_bytes            = 0;
+    stats->pad_messages         = 0;
+    stats->pad_reports          = 0;
+    stats->pad_latency_sum      = 0;
+    stats->pad_latency_max      = 0;
+    stats->ticks                = 0;
+    stats->tick_ns_sum          = 0;
+    stats->tick_ns_max          = 0;
+}
+
+/* - */
+
+maschine_driver *maschine_driver_open(const maschine_driver_config *config) {
+    struct maschine_driver *driver = calloc(1, sizeof(struct maschine_driver));
+    int r;
+    
+    if (driver == NULL)
+        return NULL;
+    
+    driver->config = *config;
+    
+    if (driver->config.transfer_window < 1 || driver->config.transfer_window > TRANSFER_WINDOW_MAX)
+        driver->config.transfer_window = TRANSFER_WINDOW_DEFAULT;
+    
+    driver->stats.enabled = config->report_stats;
+    driver_stats_init(&driver->counters);
+    
+    pad_engine_default_config(&driver->pads);
+    
+    if (config->pads && pad_engine_config_valid(config->pads))
+        driver->pads = *config->pads;
+    else if (config->pads)
+        driver_log("invalid pads config, using the defaults\n");
+    
+    r = libusb_init(&driver->usb);
+    if (r < 0) {
+        driver_log("cannot init %d\n", r);
+        free(driver);
+        return NULL;
+    }
+    
+    /* devices already connected are reported during the registration, so
+     * the event loop must be ready to accept their file descriptors
+     */
+    if (event_loop_init(&driver->loop, driver->usb) != 0) {
+        libusb_exit(driver->usb);
+        free(driver);
+        return NULL;
+    }
+    
+    driver->stats.window_start = monotonic_now_ns();
+    
+    /* before the registration, which attaches the units already there */
+    if (config->capture_path) {
+        r = usb_trace_create(
+            &driver->capture,
+            config->capture_path,
+            config->capture_capacity ? config->capture_capacity : USB_TRACE_CAPACITY_DEFAULT,
+            monotonic_now_ns()
+        );
+        
+        if (r != 0) {
+            libusb_set_pollfd_notifiers(driver->usb, NULL, NULL, NULL);
+            close(driver->loop.fd);
+            libusb_exit(driver->usb);
+            free(driver);
+            return NULL;
+        }
+        
+        driver->trace = &driver->capture;
+    }
+    
+    r = libusb_hotplug_register_callback(
+        driver->usb,
+        LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+        LIBUSB_HOTPLUG_ENUMERATE,
+        USB_VID_NATIVEINSTRUMENTS,
+        USB_PID_MASCHINECONTROLLER,
+        LIBUSB_HOTPLUG_MATCH_ANY,
+        hotplug_callback,
+        driver,
+        &driver->hotplug
+    );
+    
+    if (r != LIBUSB_SUCCESS) {
+        driver_log("Error creating a hotplug callback\n");
+        
+        if (driver->trace)
+            usb_trace_close(driver->trace);
+        
+        libusb_set_pollfd_notifiers(driver->usb, NULL, NULL, NULL);
+        close(driver->loop.fd);
+        libusb_exit(driver->usb);
+        free(driver);
+        return NULL;
+    }
+    
+    return driver;
+}
+
+void maschine_driver_close(maschine_driver *driver) {
+    maschine_driver_stop_thread(driver);
+    
+    libusb_hotplug_deregister_callback(driver->usb, driver->hotplug);
+    
+    int attached = 0;
+    
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        struct Maschine *maschine = driver->maschines[i];
+        
+        if (maschine && !maschine->closing)
+            Maschine_disconnect(maschine);
+    }
+    
+    /* the cancelled transfers come back through their callbacks */
+    for (int tries = 0; tries < 100; tries++) {
+        struct timeval tv = { 0, 10000 };
+        
+        maschines_tick(driver);
+        attached = 0;
+        
+        for (int i = 0; i < MASCHINES_MAX; i++)
+            attached += driver->maschines[i] != NULL;
+        
+        if (attached == 0)
+            break;
+        
+        libusb_handle_events_timeout(driver->usb, &tv);
+    }
+    
+    if (attached)
+        driver_log("%d units still had transfers in flight\n", attached);
+    
+    if (driver->trace)
+        usb_trace_close(driver->trace);
+    
+    libusb_set_pollfd_notifiers(driver->usb, NULL, NULL, NULL);
+    libusb_exit(driver->usb);
+    
+    close(driver->loop.fd);
+    free(driver);
+}
+
+void maschine_driver_stats(maschine_driver *driver, driver_stats_snapshot *snapshot) {
+    driver_stats_snapshot_take(&driver->counters, snapshot);
+}
+
+int maschine_driver_fd(maschine_driver *driver) {
+    return driver->loop.fd;
+}
+
+uint64_t maschine_driver_next_deadline(maschine_driver *driver) {
+    return event_loop_next_deadline(&driver->loop, driver->usb, monotonic_now_ns());
+}
+
+void maschine_driver_process(maschine_driver *driver) {
+    struct EventLoop *loop = &driver->loop;
+    struct EventLoopStats *stats = &driver->stats;
+    uint64_t now = monotonic_now_ns();
+    
+    stats->wakeup_time = now;
+    stats->wakeups++;
+    
+    if (now >= loop->next_tick) {
+        driver_stats_record(&driver->counters, DRIVER_LATENCY_TICK_LATE, now - loop->next_tick);
+        
+        maschines_tick(driver);
+        capture_tick(driver, now);
+        
+        uint64_t tick_duration = monotonic_now_ns() - now;
+        
+        stats->ticks++;
+        stats->tick_ns_sum += tick_duration;
+        
+        if (tick_duration > stats->tick_ns_max)
+            stats->tick_ns_max = tick_duration;
+        
+        loop->next_tick += TICK_INTERVAL_NS;
+        
+        /* don't try to catch up on ticks we missed while stalled */
+        if (loop->next_tick <= now)
+            loop->next_tick = now + TICK_INTERVAL_NS;
+    }
+    
+#if defined(__linux__)
+    struct epoll_event events[EVENT_LOOP_MAX_FDS];
+    int r = epoll_wait(loop->fd, events, EVENT_LOOP_MAX_FDS, 0);
+#else
+    struct kevent events[EVENT_LOOP_MAX_FDS];
+    struct timespec zero_ts = { 0, 0 };
+    int r = kevent(loop->fd, NULL, 0, events, EVENT_LOOP_MAX_FDS, &zero_ts);
+#endif
+    
+    for (int i = 0; i < r; i++) {
+#if defined(__linux__)
+        int fd = events[i].data.fd;
+#else
+        int fd = (int)events[i].ident;
+#endif
+        
+        /* looked up again every time, a callback may have removed it */
+        struct EventLoopHandler *handler = event_loop_handler(loop, fd);
+        
+        if (handler && handler->callback)
+            handler->callback(handler->user_data);
+    }
+    
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout(driver->usb, &zero);
+    
+    event_loop_stats_report(stats, monotonic_now_ns());
+}
+
+/* waits until fd is readable or wait_ns have passed. poll rather than
+ * select, which can't take descriptors past FD_SETSIZE. Returns what the
+ * poll returned
+ */
+static int wait_readable(int fd, uint64_t wait_ns) {
+    struct timespec timeout = { (time_t)(wait_ns / 1000000000ull), (long)(wait_ns % 1000000000ull) };
+    
+#if defined(__linux__)
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    
+    return ppoll(&pfd, 1, &timeout, NULL);
+#else
+    /* no ppoll here, pselect keeps the finer timeout while the descriptor
+     * fits in an fd_set
+     */
+    if (fd < FD_SETSIZE) {
+        fd_set readable;
+        
+        FD_ZERO(&readable);
+        FD_SET(fd, &readable);
+        
+        return pselect(fd + 1, &readable, NULL, NULL, &timeout, NULL);
+    }
+    
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    
+    return poll(&pfd, 1, (int)((wait_ns + 999999) / 1000000));
+#endif
+}
+
+/* waits on the fd until deadline at the latest, then processes */
+static void maschine_driver_wait(maschine_driver *driver, uint64_t deadline) {
+    uint64_t now = monotonic_now_ns();
+    
+    if (wait_readable(driver->loop.fd, deadline > now ? deadline - now : 0) < 0) {
+        /* a signal, which the application will look at when we return */
+        if (errno != EINTR)
+            driver_log("poll: %s\n", strerror(errno));
+        
+        return;
+    }
+    
+    maschine_driver_process(driver);
+}
+
+void maschine_driver_run_once(maschine_driver *driver) {
+    maschine_driver_wait(driver, maschine_driver_next_deadline(driver));
+}
+
+/* - */
+
+int maschine_driver_replay(maschine_driver *driver, const char *path, double speed) {
+    /* the unit replaying each unit of the capture */
+    struct Maschine *units[MASCHINES_MAX] = { NULL };
+    const usb_trace_record *record;
+    const uint8_t *payload;
+    size_t offset = 0;
+    int replayed = 0;
+    usb_trace trace;
+    
+    if (usb_trace_open(&trace, path) != 0)
+        return -1;
+    
+    uint64_t started = monotonic_now_ns();
+    
+    while ((record = usb_trace_next(&trace, &offset, &payload))) {
+        /* what was sent is recomputed by the driver, only what the
+         * devices answered is fed back
+         */
+        if (record->event != USB_TRACE_COMPLETE ||
+            record->status != LIBUSB_TRANSFER_COMPLETED ||
+            record->unit >= MASCHINES_MAX ||
+            (record->endpoint != 0x81 && record->endpoint != 0x84))
+            continue;
+        
+        if (speed > 0) {
+            uint64_t due = started + (uint64_t)(record->timestamp / speed);
+            
+            while (monotonic_now_ns() < due) {
+                uint64_t deadline = maschine_driver_next_deadline(driver);
+                
+                maschine_driver_wait(driver, deadline < due ? deadline : due);
+                maschines_replay_out(driver);
+            }
+        }
+        
+        /* as fast as possible, but the ticks still run */
+        else if (monotonic_now_ns() >= driver->loop.next_tick) {
+            maschine_driver_process(driver);
+            maschines_replay_out(driver);
+        }
+        
+        struct Maschine *maschine = units[record->unit];
+        
+        if (maschine == NULL) {
+            maschine = maschines_attach(driver, NULL);
+            
+            if (maschine == NULL) {
+                driver_log("no unit left to replay unit %d of the trace\n", record->unit + 1);
+                break;
+            }
+            
+            units[record->unit] = maschine;
+        }
+        
+        InEndpoint_Replay(
+            record->endpoint == 0x81 ? &maschine->ep1_command_responses : &maschine->ep4_pad_reports,
+            record->status,
+            payload,
+            record->length
+        );
+        
+        maschines_replay_out(driver);
+        replayed++;
+    }
+    
+    for (int i = 0; i < MASCHINES_MAX; i++) {
+        if (units[i])
+            Maschine_disconnect(units[i]);
+    }
+    
+    maschines_tick(driver);
+    usb_trace_close(&trace);
+    
+    return replayed;
+}
+
+/* - */
+
+int maschine_driver_send_midi(maschine_driver *driver, int unit, const uint8_t *buf, int len) {
+    struct Maschine *maschine = maschines_unit(driver, unit);
+    
+    if (maschine == NULL)
+        return -1;
+    
+    send_command_midi_write(maschine, buf, len, monotonic_now_ns());
+    
+    return 0;
+}
+
+int maschine_driver_set_led(maschine_driver *driver, int unit, enum MaschineLeds led, int on) {
+    struct Maschine *maschine = maschines_unit(driver, unit);
+    
+    if (maschine == NULL)
+        return -1;
+    
+    led_engine_set_led(&maschine->leds, led, on);
+    
+    return 0;
+}
+
+int maschine_driver_set_pads(maschine_driver *driver, int unit, const pad_engine_config *config) {
+    struct Maschine *maschine = maschines_unit(driver, unit);
+    
+    if (maschine == NULL)
+        return -1;
+    
+    return pad_engine_set_config(&maschine->pads, config);
+}
+
+uint8_t *maschine_driver_display_row(maschine_driver *driver, int unit, enum MaschineDisplay display, int row) {
+    struct Maschine *maschine = maschines_unit(driver, unit);
+    
+    if (maschine == NULL || row < 0 || row >= display_height)
+        return NULL;
+    
+    if (!display_ready(maschine))
+        return NULL;
+    
+    return display_row(maschine, display, row);
+}
+
+int maschine_driver_display_present(maschine_driver *driver, int unit, enum MaschineDisplay display) {
+    struct Maschine *maschine = maschines_unit(driver, unit);
+    
+    if (maschine == NULL)
+        return -1;
+    
+    if (display_ready(maschine))
+        display_present(maschine, display);
+    
+    return 0;
+}
+
+/* - event thread */
+
+/* touches a good chunk of stack, so that it's already mapped and locked
+ * before anything time critical runs on it
+ */
+static void event_thread_prefault_stack(void) {
+    volatile uint8_t stack[64 * 1024];
+    
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+static int event_thread_set_realtime(int priority) {
+#if defined(__APPLE__)
+    /* the time constraint policy wants mach absolute time units: we ask
+     * for up to half a millisecond of computation within every millisecond
+     */
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    
+    double ns_to_abs = (double)timebase.denom / timebase.numer;
+    
+    thread_time_constraint_policy_data_t policy;
+    policy.period      = 0;
+    policy.computation = (uint32_t)(500000  * ns_to_abs);
+    policy.constraint  = (uint32_t)(1000000 * ns_to_abs);
+    policy.preemptible = 1;
+    
+    kern_return_t r = thread_policy_set(
+        pthread_mach_thread_np(pthread_self()),
+        THREAD_TIME_CONSTRAINT_POLICY,
+        (thread_policy_t)&policy,
+        THREAD_TIME_CONSTRAINT_POLICY_COUNT
+    );
+    
+    if (r != KERN_SUCCESS) {
+        driver_log("cannot set the event thread time constraint policy: %d\n", r);
+        return 0;
+    }
+#else
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    
+    int r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    
+    if (r != 0) {
+        driver_log("cannot run the event thread at SCHED_FIFO priority %d: %s\n", priority, strerror(r));
+        return 0;
+    }
+#endif
+    
+    return 1;
+}
+
+static void *event_thread_main(void *user_data) {
+    struct maschine_driver *driver = user_data;
+    sigset_t signals;
+    
+    /* signals are for the application's threads */
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    if (driver->thread_priority)
+        driver->thread_realtime = event_thread_set_realtime(driver->thread_priority);
+    
+    event_thread_prefault_stack();
+    
+    while (atomic_load_explicit(&driver->thread_running, memory_order_acquire))
+        maschine_driver_run_once(driver);
+    
+    return NULL;
+}
+
+static int lifecycle_start(struct maschine_driver *driver) {
+    pthread_attr_t attributes;
+    int r;
+    
+    if (spsc_ring_init(&driver->lifecycle_requests, driver->lifecycle_requests_storage, LIFECYCLE_RING_SIZE, sizeof(struct LifecycleRequest)) != 0)
+        return -1;
+    
+    if (spsc_ring_init(&driver->lifecycle_done, driver->lifecycle_done_storage, LIFECYCLE_RING_SIZE, sizeof(struct LifecycleRequest)) != 0) {
+        spsc_ring_destroy(&driver->lifecycle_requests);
+        return -1;
+    }
+    
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, LIFECYCLE_THREAD_STACK_SIZE);
+    r = pthread_create(&driver->lifecycle_thread, &attributes, lifecycle_thread_main, driver);
+    pthread_attr_destroy(&attributes);
+    
+    if (r != 0) {
+        driver_log("cannot create the lifecycle thread: %s\n", strerror(r));
+        spsc_ring_destroy(&driver->lifecycle_done);
+        spsc_ring_destroy(&driver->lifecycle_requests);
+        return -1;
+    }
+    
+    event_loop_add_fd(
+        &driver->loop,
+        spsc_ring_wakeup_fd(&driver->lifecycle_done),
+        POLLIN,
+        maschines_lifecycle_done,
+        driver
+    );
+    
+    driver->lifecycle_running = 1;
+    
+    return 0;
+}
+
+/* once the event thread is gone: whatever was asked of the lifecycle
+ * thread is done before it quits, and the units it opened start here
+ */
+static void lifecycle_stop(struct maschine_driver *driver) {
+    struct LifecycleRequest *request;
+    
+    if (!driver->lifecycle_running)
+        return;
+    
+    while ((request = spsc_ring_reserve(&driver->lifecycle_requests)) == NULL) {
+        struct timespec interval = { 0, 1000000 };
+        nanosleep(&interval, NULL);
+    }
+    
+    request->kind = LifecycleRequest_Quit;
+    spsc_ring_commit(&driver->lifecycle_requests);
+    
+    pthread_join(driver->lifecycle_thread, NULL);
+    driver->lifecycle_running = 0;
+    
+    event_loop_remove_fd(&driver->loop, spsc_ring_wakeup_fd(&driver->lifecycle_done));
+    maschines_lifecycle_done(driver);
+    
+    spsc_ring_destroy(&driver->lifecycle_done);
+    spsc_ring_destroy(&driver->lifecycle_requests);
+}
+
+int maschine_driver_start_thread(maschine_driver *driver, int priority) {
+    if (driver->thread_started)
+        return -1;
+    
+    driver_log_defer(1);
+    
+#if defined(__linux__)
+    /* the transfers, queues and framebuffers of every unit are part of its
+     * state, locking it keeps them from ever being paged out
+     */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        driver_log("cannot lock the driver memory: %s\n", strerror(errno));
+#endif
+    
+    /* units plugged in while the thread runs are opened on another */
+    if (lifecycle_start(driver) != 0) {
+        driver_log_defer(0);
+        return -1;
+    }
+    
+    driver->thread_priority = priority;
+    atomic_store_explicit(&driver->thread_running, 1, memory_order_release);
+    
+    int r = pthread_create(&driver->thread, NULL, event_thread_main, driver);
+    
+    if (r != 0) {
+        driver_log("cannot create the event thread: %s\n", strerror(r));
+        lifecycle_stop(driver);
+        driver_log_defer(0);
+        return -1;
+    }
+    
+    driver->thread_started = 1;
+    
+    return 0;
+}
+
+void maschine_driver_stop_thread(maschine_driver *driver) {
+    if (!driver->thread_started)
+        return;
+    
+    /* the thread notices within a tick */
+    atomic_store_explicit(&driver->thread_running, 0, memory_order_release);
+    pthread_join(driver->thread, NULL);
+    
+    driver->thread_started = 0;
+    
+    lifecycle_stop(driver);
+    
+    driver_log_drain(NULL);
+    driver_log_defer(0);
+}
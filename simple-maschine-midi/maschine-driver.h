@@ -0,0 +1,187 @@
+//
+//  maschine-driver.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef maschine_driver_h
+#define maschine_driver_h
+
+#include <stdint.h>
+
+#include "midi-backend.h"
+#include "controls-map.h"
+#include "driver-stats.h"
+#include "pad-state-machine.h"
+
+/* the driver as a library, to run the Maschines inside a host application
+ * on its own event loop:
+ *
+ *     maschine_driver *driver = maschine_driver_open(&config);
+ *
+ *     add maschine_driver_fd(driver) to the application's poll, epoll or
+ *     kqueue, and whenever it's readable or maschine_driver_next_deadline
+ *     has passed, call maschine_driver_process(driver)
+ *
+ * every function must be called from that same thread, and so are the
+ * callbacks. Units are numbered from 0 in the order they're attached, a
+ * number is reused once its unit has been unplugged and released.
+ */
+
+typedef struct maschine_driver maschine_driver;
+
+enum { MASCHINE_DRIVER_UNITS_MAX = 16 };
+
+enum { MASCHINE_DRIVER_TRANSFER_WINDOW_MAX     = 8 };
+enum { MASCHINE_DRIVER_TRANSFER_WINDOW_DEFAULT = 4 };
+
+/* 255 x 64 pixels, 3 pixels every 2 bytes */
+enum { MASCHINE_DISPLAY_WIDTH    = 255 };
+enum { MASCHINE_DISPLAY_HEIGHT   =  64 };
+enum { MASCHINE_DISPLAY_ROW_SIZE = MASCHINE_DISPLAY_WIDTH * 2 / 3 };
+
+enum MaschineDisplay {
+    MaschineDisplay_Left  = 0 << 1,
+    MaschineDisplay_Right = 1 << 1,
+};
+
+/* the MIDI a unit produces from its pads, buttons, encoders and MIDI in.
+ * buf holds one or more complete messages, timestamp is when the USB
+ * transfer they came from completed, on CLOCK_MONOTONIC in nanoseconds
+ */
+typedef void (maschine_driver_midi_callback)(
+    maschine_driver *driver,
+    int unit,
+    uint64_t timestamp,
+    const uint8_t *buf,
+    int len,
+    void *user_data
+);
+
+typedef void (maschine_driver_unit_callback)(
+    maschine_driver *driver,
+    int unit,
+    int connected,
+    void *user_data
+);
+
+typedef struct {
+    /* where to create each unit's MIDI ports, NULL to only hand the MIDI
+     * to the midi callback
+     */
+    const midi_backend *host_midi;
+
+    /* transfers kept in flight on each outgoing endpoint, 1 to
+     * MASCHINE_DRIVER_TRANSFER_WINDOW_MAX. 0 for the default
+     */
+    int transfer_window;
+
+    /* the pads LED animation and the displays test pattern */
+    int demo;
+    
+    /* thresholds, notes and velocity of every unit's pads, copied at
+     * open. NULL for pad_engine_default_config
+     */
+    const pad_engine_config *pads;
+
+    /* print the event loop statistics every second */
+    int report_stats;
+    
+    /* records every transfer to this file, see usb-trace.h. NULL for none */
+    const char *capture_path;
+    
+    /* bytes mapped for the capture, all of them locked in memory on a real
+     * time thread. Once full, records are dropped. 0 for the default
+     */
+    size_t capture_capacity;
+
+    maschine_driver_midi_callback *midi;
+    maschine_driver_unit_callback *unit;
+    void *user_data;
+} maschine_driver_config;
+
+/* returns NULL if libusb cannot be initialized. Units already plugged
+ * in are attached, and reported to the unit callback, before it returns
+ */
+maschine_driver *maschine_driver_open(const maschine_driver_config *config);
+
+/* detaches from every unit and waits for libusb to hand back their
+ * transfers, for at most a second
+ */
+void maschine_driver_close(maschine_driver *driver);
+
+/* an epoll (Linux) or kqueue (macOS) descriptor, readable when there is
+ * USB or host MIDI work to do
+ */
+int maschine_driver_fd(maschine_driver *driver);
+
+/* when maschine_driver_process must run even if the fd never becomes
+ * readable, on CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t maschine_driver_next_deadline(maschine_driver *driver);
+
+/* handles what is ready and what is due, never blocks */
+void maschine_driver_process(maschine_driver *driver);
+
+/* for applications without a loop of their own: waits on the fd until
+ * the next deadline, then processes
+ */
+void maschine_driver_run_once(maschine_driver *driver);
+
+/* runs maschine_driver_run_once on a thread of its own, until stopped.
+ * The process memory is locked (Linux), and with a priority other than
+ * 0 the thread runs under SCHED_FIFO at that priority, or the time
+ * constraint policy on macOS. A policy that can't be granted is logged
+ * and the thread runs anyway.
+ *
+ * the driver logs are deferred while it runs, see driver-log.h, and the
+ * driver must not be called from any other thread but to stop it.
+ * Returns -1 if the thread cannot be created
+ */
+int  maschine_driver_start_thread(maschine_driver *driver, int priority);
+
+/* joins the thread and prints the logs it left behind */
+void maschine_driver_stop_thread(maschine_driver *driver);
+
+/* the latency histograms, queue high water marks and failure counters
+ * of the driver since it was opened. Unlike the rest, it can be called
+ * from any thread, even while the driver's own thread runs
+ */
+void maschine_driver_stats(maschine_driver *driver, driver_stats_snapshot *snapshot);
+
+/* feeds what the devices answered in a capture back through the driver,
+ * each unit of the capture as a unit of its own, without a device behind
+ * it: what the driver sends is completed right away. At the recorded
+ * pace times speed, or as fast as possible with a speed of 0.
+ *
+ * returns once the whole trace has been fed, with the replaying units
+ * released, how many transfers were replayed or -1 if the file cannot
+ * be read
+ */
+int  maschine_driver_replay(maschine_driver *driver, const char *path, double speed);
+
+/* the following return -1 if there is no such unit */
+
+/* queues MIDI for the unit's MIDI out */
+int maschine_driver_send_midi(maschine_driver *driver, int unit, const uint8_t *buf, int len);
+
+/* LEDs are sent with the next tick, at most 80 times a second */
+int maschine_driver_set_led(maschine_driver *driver, int unit, enum MaschineLeds led, int on);
+
+/* from the next pad report on, also -1 if pad_engine_set_config
+ * rejects the config
+ */
+int maschine_driver_set_pads(maschine_driver *driver, int unit, const pad_engine_config *config);
+
+/* a row of the framebuffer to draw into, 3 pixels every 2 bytes. It can
+ * be drawn at any time, a present copies what changed out of it. NULL
+ * while the display is still being initialized
+ */
+uint8_t *maschine_driver_display_row(maschine_driver *driver, int unit, enum MaschineDisplay display, int row);
+
+/* sends the rows that changed since the last frame */
+int maschine_driver_display_present(maschine_driver *driver, int unit, enum MaschineDisplay display);
+
+#endif /* maschine_driver_h */
@@ -0,0 +1,254 @@
+//
+//  midi-backend-alsa.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifdef __linux__
+
+#include "midi-backend.h"
+#include "driver-log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+/* one sequencer client per Maschine, like the CoreMIDI backend. Incoming
+ * events are read by a thread of the port, which plays the part of the
+ * CoreMIDI thread; outgoing events are written with direct delivery, so
+ * they skip the sequencer queues entirely. They are collected in the
+ * client's output buffer and written to the sequencer with one call on
+ * flush.
+ *
+ * direct events are delivered at once and carry no timestamp: a real
+ * time stamp is read against the clock of a queue, and a direct event
+ * has none. Scheduling them on a queue would delay every message for
+ * the sake of the timestamp, so the one from the Maschine is dropped.
+ */
+
+enum { ALSA_CODEC_BUFFER_SIZE = 1024 };
+enum { ALSA_MAX_POLLFDS       = 8 };
+
+struct midi_port {
+    snd_seq_t *seq;
+    int source;
+    int destination;
+    
+    snd_midi_event_t *encoder;
+    snd_midi_event_t *decoder;
+    
+    midi_backend_receive_callback *receive;
+    void *user_data;
+    
+    pthread_t thread;
+    int thread_started;
+    int stop_fds[2];
+};
+
+static void alsa_receive_event(midi_port *port, snd_seq_event_t *ev) {
+    uint8_t buf[ALSA_CODEC_BUFFER_SIZE];
+    
+    /* sysex can be bigger than any buffer, and needs no decoding */
+    if (ev->type == SND_SEQ_EVENT_SYSEX) {
+        port->receive(ev->data.ext.ptr, ev->data.ext.len, port->user_data);
+        return;
+    }
+    
+    long len = snd_midi_event_decode(port->decoder, buf, sizeof(buf), ev);
+    
+    if (len > 0)
+        port->receive(buf, (int)len, port->user_data);
+}
+
+static void *alsa_input_thread(void *user_data) {
+    midi_port *port = (midi_port *)user_data;
+    struct pollfd fds[ALSA_MAX_POLLFDS + 1];
+    
+    int nfds = snd_seq_poll_descriptors(port->seq, fds, ALSA_MAX_POLLFDS, POLLIN);
+    
+    fds[nfds].fd     = port->stop_fds[0];
+    fds[nfds].events = POLLIN;
+    
+    while (1) {
+        if (poll(fds, nfds + 1, -1) < 0)
+            continue;
+        
+        if (fds[nfds].revents)
+            break;
+        
+        while (snd_seq_event_input_pending(port->seq, 1) > 0) {
+            snd_seq_event_t *ev;
+            
+            if (snd_seq_event_input(port->seq, &ev) < 0)
+                break;
+            
+            alsa_receive_event(port, ev);
+        }
+    }
+    
+    return NULL;
+}
+
+static void alsa_close(midi_port *port);
+
+static midi_port *alsa_open(
+    const char *name,
+    int index,
+    midi_backend_receive_callback *receive,
+    void *user_data
+) {
+    char buf[128];
+    int r;
+    
+    midi_port *port = calloc(1, sizeof(midi_port));
+    
+    if (port == NULL)
+        return NULL;
+    
+    port->receive      = receive;
+    port->user_data    = user_data;
+    port->source       = -1;
+    port->destination  = -1;
+    port->stop_fds[0]  = -1;
+    port->stop_fds[1]  = -1;
+    
+    r = snd_seq_open(&port->seq, "default", SND_SEQ_OPEN_DUPLEX, 0);
+    
+    if (r < 0) {
+        driver_log("cannot open the alsa sequencer: %s\n", snd_strerror(r));
+        free(port);
+        return NULL;
+    }
+    
+    midi_backend_port_name(buf, sizeof(buf), name, " Driver", index);
+    snd_seq_set_client_name(port->seq, buf);
+    
+    midi_backend_port_name(buf, sizeof(buf), name, " In", index);
+    port->source = snd_seq_create_simple_port(
+        port->seq,
+        buf,
+        SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+        SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION
+    );
+    
+    midi_backend_port_name(buf, sizeof(buf), name, " Out", index);
+    port->destination = snd_seq_create_simple_port(
+        port->seq,
+        buf,
+        SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+        SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION
+    );
+    
+    if (port->source < 0 || port->destination < 0) {
+        driver_log("cannot create the alsa sequencer ports\n");
+        alsa_close(port);
+        return NULL;
+    }
+    
+    if (snd_midi_event_new(ALSA_CODEC_BUFFER_SIZE, &port->encoder) < 0 ||
+        snd_midi_event_new(ALSA_CODEC_BUFFER_SIZE, &port->decoder) < 0) {
+        driver_log("cannot create the alsa midi event codecs\n");
+        alsa_close(port);
+        return NULL;
+    }
+    
+    /* every message handed to the driver must be complete on its own */
+    snd_midi_event_no_status(port->decoder, 1);
+    
+    if (pipe(port->stop_fds) != 0) {
+        driver_log("cannot create the alsa stop pipe: %s\n", strerror(errno));
+        alsa_close(port);
+        return NULL;
+    }
+    
+    if (pthread_create(&port->thread, NULL, alsa_input_thread, port) != 0) {
+        driver_log("cannot start the alsa input thread\n");
+        alsa_close(port);
+        return NULL;
+    }
+    
+    port->thread_started = 1;
+    
+    return port;
+}
+
+static void alsa_close(midi_port *port) {
+    if (port->thread_started) {
+        uint8_t stop = 1;
+        
+        if (write(port->stop_fds[1], &stop, 1) == 1)
+            pthread_join(port->thread, NULL);
+    }
+    
+    if (port->stop_fds[0] >= 0) {
+        close(port->stop_fds[0]);
+        close(port->stop_fds[1]);
+    }
+    
+    if (port->encoder)
+        snd_midi_event_free(port->encoder);
+    
+    if (port->decoder)
+        snd_midi_event_free(port->decoder);
+    
+    snd_seq_close(port->seq);
+    free(port);
+}
+
+static void alsa_flush(midi_port *port) {
+    int r = snd_seq_drain_output(port->seq);
+    
+    if (r < 0)
+        driver_log("cannot send to the alsa sequencer: %s\n", snd_strerror(r));
+}
+
+static void alsa_send(midi_port *port, uint64_t timestamp, const uint8_t *buf, int len) {
+    while (len > 0) {
+        snd_seq_event_t ev;
+        snd_seq_ev_clear(&ev);
+        
+        long consumed = snd_midi_event_encode(port->encoder, buf, len, &ev);
+        
+        if (consumed <= 0) {
+            snd_midi_event_reset_encode(port->encoder);
+            return;
+        }
+        
+        buf += consumed;
+        len -= consumed;
+        
+        if (ev.type == SND_SEQ_EVENT_NONE)
+            continue;
+        
+        snd_seq_ev_set_source(&ev, port->source);
+        snd_seq_ev_set_subs(&ev);
+        snd_seq_ev_set_direct(&ev);
+        
+        int r = snd_seq_event_output(port->seq, &ev);
+        
+        /* the output buffer is full, make room and try again */
+        if (r == -EAGAIN || r == -ENOMEM) {
+            alsa_flush(port);
+            r = snd_seq_event_output(port->seq, &ev);
+        }
+        
+        if (r < 0)
+            driver_log("cannot send to the alsa sequencer: %s\n", snd_strerror(r));
+    }
+}
+
+const midi_backend midi_backend_alsa = {
+    .name  = "alsa",
+    .open  = alsa_open,
+    .close = alsa_close,
+    .send  = alsa_send,
+    .flush = alsa_flush,
+};
+
+#endif /* __linux__ */
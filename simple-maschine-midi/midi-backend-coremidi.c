@@ -0,0 +1,211 @@
+//
+//  midi-backend-coremidi.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifdef __APPLE__
+
+#include "midi-backend.h"
+#include "driver-log.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <mach/mach_time.h>
+#include <CoreMIDI/CoreMIDI.h>
+
+/* room for the messages of a USB completion, or one sysex fragment */
+enum { COREMIDI_PACKET_LIST_SIZE = 2048 };
+
+struct midi_port {
+    MIDIClientRef client;
+    MIDIEndpointRef source;
+    MIDIEndpointRef destination;
+    
+    midi_backend_receive_callback *receive;
+    void *user_data;
+    
+    uint8_t packet_list_data[COREMIDI_PACKET_LIST_SIZE];
+    MIDIPacketList *packet_list;
+    MIDIPacket *packet;
+    
+    /* the last timestamp of the batch and its host time, converted once
+     * for all the messages of a completion
+     */
+    uint64_t timestamp;
+    MIDITimeStamp time;
+};
+
+static CFStringRef coremidi_name(const char *name, const char *suffix, int index) {
+    char buf[128];
+    
+    midi_backend_port_name(buf, sizeof(buf), name, suffix, index);
+    
+    return CFStringCreateWithCString(NULL, buf, kCFStringEncodingUTF8);
+}
+
+/* runs on the CoreMIDI thread */
+static void coremidi_read(
+    const MIDIPacketList * pktlist,
+    void * refCon,
+    void * connRefCon
+) {
+    midi_port *port = (midi_port *)refCon;
+    MIDIPacket * packet = (MIDIPacket *)pktlist->packet;
+    
+    for (int i = 0; i < pktlist->numPackets; i++) {
+        port->receive(packet->data, packet->length, port->user_data);
+        packet = MIDIPacketNext(packet);
+    }
+}
+
+static void coremidi_close(midi_port *port);
+
+static midi_port *coremidi_open(
+    const char *name,
+    int index,
+    midi_backend_receive_callback *receive,
+    void *user_data
+) {
+    OSStatus s;
+    CFStringRef cfname;
+    
+    midi_port *port = calloc(1, sizeof(midi_port));
+    
+    if (port == NULL)
+        return NULL;
+    
+    port->receive     = receive;
+    port->user_data   = user_data;
+    port->packet_list = (MIDIPacketList *)port->packet_list_data;
+    port->packet      = MIDIPacketListInit(port->packet_list);
+    
+    cfname = coremidi_name(name, " Driver", index);
+    s = MIDIClientCreate(cfname, NULL, NULL, &port->client);
+    CFRelease(cfname);
+    
+    if (s != noErr) {
+        driver_log("cannot create midi client: %d\n", s);
+        free(port);
+        return NULL;
+    }
+    
+    cfname = coremidi_name(name, " In", index);
+    s = MIDISourceCreate(port->client, cfname, &port->source);
+    CFRelease(cfname);
+    
+    if (s != noErr) {
+        driver_log("cannot create source endpoint: %d\n", s);
+        coremidi_close(port);
+        return NULL;
+    }
+    
+    cfname = coremidi_name(name, " Out", index);
+    s = MIDIDestinationCreate(port->client, cfname, coremidi_read, port, &port->destination);
+    CFRelease(cfname);
+    
+    if (s != noErr) {
+        driver_log("cannot create destination endpoint: %d\n", s);
+        coremidi_close(port);
+        return NULL;
+    }
+    
+    return port;
+}
+
+static void coremidi_close(midi_port *port) {
+    OSStatus s;
+    
+    if (port->source) {
+        s = MIDIEndpointDispose(port->source);
+        if (s != noErr) {
+            driver_log("cannot dispose source %d\n", s);
+        }
+    }
+    
+    if (port->destination) {
+        s = MIDIEndpointDispose(port->destination);
+        if (s != noErr) {
+            driver_log("cannot dispose destination %d\n", s);
+        }
+    }
+    
+    s = MIDIClientDispose(port->client);
+    if (s != noErr) {
+        driver_log("cannot dispose client %d\n", s);
+    }
+    
+    free(port);
+}
+
+/* CoreMIDI wants host time, which doesn't tick in nanoseconds and may
+ * not count the same as CLOCK_MONOTONIC; only the age of the timestamp
+ * is carried over
+ */
+static MIDITimeStamp coremidi_host_time(uint64_t timestamp) {
+    static mach_timebase_info_data_t timebase;
+    struct timespec ts;
+    
+    if (timestamp == 0)
+        return 0;
+    
+    if (timebase.denom == 0)
+        mach_timebase_info(&timebase);
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    uint64_t age = now > timestamp ? now - timestamp : 0;
+    uint64_t host_now = mach_absolute_time();
+    uint64_t host_age = age * timebase.denom / timebase.numer;
+    
+    return host_age < host_now ? host_now - host_age : host_now;
+}
+
+static void coremidi_flush(midi_port *port) {
+    if (port->packet_list->numPackets == 0)
+        return;
+    
+    MIDIReceived(port->source, port->packet_list);
+    port->packet = MIDIPacketListInit(port->packet_list);
+}
+
+static void coremidi_send(midi_port *port, uint64_t timestamp, const uint8_t *buf, int len) {
+    MIDIPacket *packet;
+    
+    if (timestamp != port->timestamp) {
+        port->timestamp = timestamp;
+        port->time = coremidi_host_time(timestamp);
+    }
+    
+    MIDITimeStamp time = port->time;
+    
+    /* messages with the same timestamp end up in the same packet, which
+     * needs the same host time for all of them
+     */
+    packet = MIDIPacketListAdd(port->packet_list, sizeof(port->packet_list_data), port->packet, time, len, buf);
+    
+    if (packet == NULL) {
+        coremidi_flush(port);
+        packet = MIDIPacketListAdd(port->packet_list, sizeof(port->packet_list_data), port->packet, time, len, buf);
+    }
+    
+    if (packet == NULL) {
+        driver_log("cannot send %d bytes of midi\n", len);
+        return;
+    }
+    
+    port->packet = packet;
+}
+
+const midi_backend midi_backend_coremidi = {
+    .name  = "coremidi",
+    .open  = coremidi_open,
+    .close = coremidi_close,
+    .send  = coremidi_send,
+    .flush = coremidi_flush,
+};
+
+#endif /* __APPLE__ */
@@ -0,0 +1,102 @@
+//
+//  midi-backend-loopback.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "midi-backend.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* what's sent is kept until taken; when nobody takes it the oldest bytes
+ * are overwritten, counting them in lost
+ */
+enum { LOOPBACK_SENT_SIZE = 4096 };
+
+struct midi_port {
+    midi_backend_receive_callback *receive;
+    void *user_data;
+    
+    uint8_t sent[LOOPBACK_SENT_SIZE];
+    size_t first;
+    size_t len;
+    size_t lost;
+    
+    unsigned int flushes;
+    uint64_t last_timestamp;
+};
+
+static midi_port *loopback_open(
+    const char *name,
+    int index,
+    midi_backend_receive_callback *receive,
+    void *user_data
+) {
+    midi_port *port = calloc(1, sizeof(midi_port));
+    
+    if (port == NULL)
+        return NULL;
+    
+    port->receive   = receive;
+    port->user_data = user_data;
+    
+    return port;
+}
+
+static void loopback_close(midi_port *port) {
+    free(port);
+}
+
+static void loopback_send(midi_port *port, uint64_t timestamp, const uint8_t *buf, int len) {
+    port->last_timestamp = timestamp;
+    
+    for (int i = 0; i < len; i++) {
+        if (port->len == LOOPBACK_SENT_SIZE) {
+            port->first = (port->first + 1) % LOOPBACK_SENT_SIZE;
+            port->len--;
+            port->lost++;
+        }
+        
+        port->sent[(port->first + port->len) % LOOPBACK_SENT_SIZE] = buf[i];
+        port->len++;
+    }
+}
+
+static void loopback_flush(midi_port *port) {
+    port->flushes++;
+}
+
+unsigned int midi_loopback_flushes(midi_port *port) {
+    return port->flushes;
+}
+
+uint64_t midi_loopback_last_timestamp(midi_port *port) {
+    return port->last_timestamp;
+}
+
+void midi_loopback_inject(midi_port *port, const uint8_t *buf, int len) {
+    port->receive(buf, len, port->user_data);
+}
+
+size_t midi_loopback_take_sent(midi_port *port, uint8_t *buf, size_t len) {
+    size_t taken = 0;
+    
+    while (taken < len && port->len > 0) {
+        buf[taken++] = port->sent[port->first];
+        port->first = (port->first + 1) % LOOPBACK_SENT_SIZE;
+        port->len--;
+    }
+    
+    return taken;
+}
+
+const midi_backend midi_backend_loopback = {
+    .name  = "loopback",
+    .open  = loopback_open,
+    .close = loopback_close,
+    .send  = loopback_send,
+    .flush = loopback_flush,
+};
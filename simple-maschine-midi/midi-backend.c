@@ -0,0 +1,44 @@
+//
+//  midi-backend.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "midi-backend.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const midi_backend *backends[] = {
+#ifdef __APPLE__
+    &midi_backend_coremidi,
+#endif
+#ifdef __linux__
+    &midi_backend_alsa,
+#endif
+    &midi_backend_loopback,
+};
+
+static const int backends_count = sizeof(backends) / sizeof(backends[0]);
+
+const midi_backend *midi_backend_default(void) {
+    return backends[0];
+}
+
+const midi_backend *midi_backend_find(const char *name) {
+    for (int i = 0; i < backends_count; i++) {
+        if (strcmp(backends[i]->name, name) == 0)
+            return backends[i];
+    }
+    
+    return NULL;
+}
+
+void midi_backend_port_name(char *buf, size_t size, const char *name, const char *suffix, int index) {
+    if (index == 0)
+        snprintf(buf, size, "%s%s", name, suffix);
+    else
+        snprintf(buf, size, "%s%s %d", name, suffix, index + 1);
+}
@@ -0,0 +1,83 @@
+//
+//  midi-backend.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef midi_backend_h
+#define midi_backend_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* the host side of the driver: every Maschine gets a pair of ports, a
+ * source the driver sends the controller's MIDI to, and a destination
+ * the applications send MIDI for the controller to.
+ *
+ * receive is called from a thread owned by the backend, always the same
+ * one for a given port, with one or more complete MIDI messages, or a
+ * part of a sysex.
+ */
+
+typedef void (midi_backend_receive_callback)(const uint8_t *buf, int len, void *user_data);
+
+typedef struct midi_port midi_port;
+
+typedef struct {
+    const char *name;
+    
+    /* index numbers the ports of the second and later units, returns
+     * NULL if the ports cannot be created
+     */
+    midi_port *(*open)(
+        const char *name,
+        int index,
+        midi_backend_receive_callback *receive,
+        void *user_data
+    );
+    
+    /* receive is not called anymore once this returns */
+    void (*close)(midi_port *port);
+    
+    /* adds one or more complete messages, or a sysex fragment, to the
+     * batch of the source. timestamp is when they were received from the
+     * Maschine, in CLOCK_MONOTONIC nanoseconds, 0 for now
+     */
+    void (*send)(midi_port *port, uint64_t timestamp, const uint8_t *buf, int len);
+    
+    /* delivers the batch to the applications connected to the source */
+    void (*flush)(midi_port *port);
+} midi_backend;
+
+#ifdef __APPLE__
+extern const midi_backend midi_backend_coremidi;
+#endif
+
+#ifdef __linux__
+extern const midi_backend midi_backend_alsa;
+#endif
+
+/* keeps what's sent in memory, and lets tests play the applications'
+ * side with midi_loopback_inject
+ */
+extern const midi_backend midi_backend_loopback;
+
+void   midi_loopback_inject(midi_port *port, const uint8_t *buf, int len);
+size_t midi_loopback_take_sent(midi_port *port, uint8_t *buf, size_t len);
+
+/* how many batches were flushed, and the timestamp of the last message */
+unsigned int midi_loopback_flushes(midi_port *port);
+uint64_t     midi_loopback_last_timestamp(midi_port *port);
+
+/* the native backend of the platform, or the one with the given name */
+const midi_backend *midi_backend_default(void);
+const midi_backend *midi_backend_find(const char *name);
+
+/* the first unit keeps the plain names, so existing setups don't need to
+ * be re-patched, the others are numbered from 2
+ */
+void midi_backend_port_name(char *buf, size_t size, const char *name, const char *suffix, int index);
+
+#endif /* midi_backend_h */
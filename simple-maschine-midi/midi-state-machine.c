@@ -8,11 +8,41 @@
 
 #include "midi-state-machine.h"
 #include <stdio.h>
+#include <string.h>
 
 void midi_parser_init(midi_parser * parser, midi_parser_callback *callback, void *user_data) {
     parser->state = midi_parser_wait_for_status;
     parser->send = callback;
     parser->user_data = user_data;
+    parser->send_batch = NULL;
+    parser->batch_len = 0;
+    parser->send_realtime = NULL;
+    parser->send_sysex = NULL;
+    parser->sysex_fragment_size = MIDI_PARSER_PACKET_SIZE;
+    parser->sysex_started = 0;
+}
+
+void midi_parser_set_batch_callback(midi_parser * parser, midi_parser_callback *callback) {
+    parser->send_batch = callback;
+}
+
+void midi_parser_set_realtime_callback(midi_parser * parser, midi_parser_callback *callback) {
+    parser->send_realtime = callback;
+}
+
+void midi_parser_set_sysex_callback(
+    midi_parser * parser,
+    midi_parser_sysex_callback *callback,
+    int fragment_size
+) {
+    if (fragment_size < 1)
+        fragment_size = 1;
+    
+    if (fragment_size > MIDI_PARSER_PACKET_SIZE)
+        fragment_size = MIDI_PARSER_PACKET_SIZE;
+    
+    parser->send_sysex = callback;
+    parser->sysex_fragment_size = fragment_size;
 }
 
 static int next_state_for_byte(uint8_t byte, midi_parser_state *next) {
@@ -30,7 +60,7 @@ static int next_state_for_byte(uint8_t byte, midi_parser_state *next) {
             *next = midi_parser_receive_data_byte;
             return 1;
             
-        case 0xf0: // realtime messages
+        case 0xf0: // system common, real time bytes never get here
             switch (byte) {
                 case 0xf0:
                     *next = midi_parser_receive_sysex;
@@ -50,10 +80,86 @@ static int next_state_for_byte(uint8_t byte, midi_parser_state *next) {
     return 0;
 }
 
-void midi_parser_parse(midi_parser * parser, uint8_t byte) {
+static void batch_flush(midi_parser * parser) {
+    if (parser->batch_len == 0)
+        return;
+    
+    parser->send_batch(parser->batch, parser->batch_len, parser->user_data);
+    parser->batch_len = 0;
+}
+
+static inline void emit(midi_parser * parser, uint8_t *buf, int len, int batched) {
+    if (!batched) {
+        parser->send(buf, len, parser->user_data);
+        return;
+    }
+    
+    if (parser->batch_len + len > MIDI_PARSER_BATCH_SIZE)
+        batch_flush(parser);
+    
+    /* only sysex can be this long, it goes on its own */
+    if (len > MIDI_PARSER_BATCH_SIZE) {
+        parser->send_batch(buf, len, parser->user_data);
+        return;
+    }
+    
+    memcpy(parser->batch + parser->batch_len, buf, len);
+    parser->batch_len += len;
+}
+
+/* hands over the sysex bytes collected so far. Fragments never share a
+ * batch with other messages, so the batch before them is flushed first
+ */
+static void sysex_emit(midi_parser * parser, int end, int batched) {
+    int flags = 0;
+    
+    if (!parser->sysex_started)
+        flags |= MIDI_PARSER_SYSEX_START;
+    
+    if (end)
+        flags |= MIDI_PARSER_SYSEX_END;
+    
+    if (flags == 0)
+        flags = MIDI_PARSER_SYSEX_CONTINUE;
+    
+    if (batched)
+        batch_flush(parser);
+    
+    /* an interrupted sysex may have nothing left but its end */
+    if (parser->send_sysex)
+        parser->send_sysex(parser->packet, parser->len, flags, parser->user_data);
+    else if (parser->len == 0)
+        ;
+    else if (batched)
+        parser->send_batch(parser->packet, parser->len, parser->user_data);
+    else
+        parser->send(parser->packet, parser->len, parser->user_data);
+    
+    parser->sysex_started = !end;
+    parser->len = 0;
+}
+
+static inline void parse_realtime(midi_parser * parser, uint8_t byte, int batched) {
+    uint8_t message[1] = { byte };
+    
+    if (parser->send_realtime)
+        parser->send_realtime(message, 1, parser->user_data);
+    else
+        emit(parser, message, 1, batched);
+}
+
+static inline void parse_byte(midi_parser * parser, uint8_t byte, int batched) {
     midi_parser_state next;
 
+    if (byte >= 0xf8) {
+        parse_realtime(parser, byte, batched);
+        return;
+    }
+    
     if (next_state_for_byte(byte, &next)) {
+        if (parser->state == midi_parser_receive_sysex)
+            sysex_emit(parser, 1, batched);
+        
         parser->len = 1;
         parser->packet[0] = byte;
         parser->state = next;
@@ -72,28 +178,85 @@ void midi_parser_parse(midi_parser * parser, uint8_t byte) {
             case midi_parser_receive_2nd_data_byte: {
                 parser->packet[2] = byte;
                 parser->state = midi_parser_receive_1st_data_byte;
-                parser->send(parser->packet, 3, parser->user_data);
+                emit(parser, parser->packet, 3, batched);
                 break;
             }
                 
             case midi_parser_receive_data_byte: {
                 parser->packet[1] = byte;
-                parser->send(parser->packet, 2, parser->user_data);
+                emit(parser, parser->packet, 2, batched);
                 break;
             }
                 
             case midi_parser_receive_sysex: {
+                /* only with fragments of 1 byte, right after the 0xf0 */
+                if (parser->len >= parser->sysex_fragment_size)
+                    sysex_emit(parser, 0, batched);
+                
                 parser->packet[parser->len] = byte;
                 parser->len++;
                 
                 if (byte == 0xf7) {
-                    parser->send(parser->packet, parser->len, parser->user_data);
+                    sysex_emit(parser, 1, batched);
                     parser->state = midi_parser_wait_for_status;
                 }
                 
+                else if (parser->len >= parser->sysex_fragment_size) {
+                    sysex_emit(parser, 0, batched);
+                }
+                
                 break;
-            }                
+            }
 
         }
     }
 }
+
+void midi_parser_parse(midi_parser * parser, uint8_t byte) {
+    parse_byte(parser, byte, 0);
+}
+
+void midi_parser_parse_buffer(midi_parser * parser, const uint8_t *buf, int len) {
+    int batched = parser->send_batch != NULL;
+    int i = 0;
+    
+    while (i < len) {
+        /* running status: as long as data bytes keep coming, every pair or
+         * single byte is a whole message with the same status
+         */
+        if (parser->state == midi_parser_receive_1st_data_byte) {
+            while (i + 1 < len && buf[i] < 0x80 && buf[i + 1] < 0x80) {
+                parser->packet[1] = buf[i];
+                parser->packet[2] = buf[i + 1];
+                emit(parser, parser->packet, 3, batched);
+                i += 2;
+            }
+        }
+        
+        else if (parser->state == midi_parser_receive_data_byte) {
+            while (i < len && buf[i] < 0x80) {
+                parser->packet[1] = buf[i];
+                emit(parser, parser->packet, 2, batched);
+                i++;
+            }
+        }
+        
+        /* sysex data is copied up to the end of the fragment, leaving
+         * the last byte of it to parse_byte, which sends the fragment
+         */
+        else if (parser->state == midi_parser_receive_sysex) {
+            int room = parser->sysex_fragment_size - parser->len - 1;
+            
+            while (room > 0 && i < len && buf[i] < 0x80) {
+                parser->packet[parser->len++] = buf[i++];
+                room--;
+            }
+        }
+        
+        if (i < len)
+            parse_byte(parser, buf[i++], batched);
+    }
+    
+    if (batched)
+        batch_flush(parser);
+}
@@ -24,15 +24,73 @@ typedef enum {
 
 typedef void (midi_parser_callback)(uint8_t *buf, int len, void *user_data);
 
+/* which part of a sysex a fragment is. A sysex that fits in one fragment
+ * is both the start and the end. A sysex interrupted by a status byte is
+ * ended without its 0xf7
+ */
+enum {
+    MIDI_PARSER_SYSEX_START    = 1 << 0,
+    MIDI_PARSER_SYSEX_CONTINUE = 1 << 1,
+    MIDI_PARSER_SYSEX_END      = 1 << 2,
+};
+
+typedef void (midi_parser_sysex_callback)(uint8_t *buf, int len, int flags, void *user_data);
+
+enum { MIDI_PARSER_PACKET_SIZE = 1024 };
+
+/* complete messages found by midi_parser_parse_buffer are collected here,
+ * when there's a batch callback
+ */
+enum { MIDI_PARSER_BATCH_SIZE = 256 };
+
 typedef struct {
     midi_parser_state state;
     midi_parser_callback *send;
-    uint8_t packet[1024];
+    uint8_t packet[MIDI_PARSER_PACKET_SIZE];
     int len;
     void *user_data;
+    
+    midi_parser_callback *send_batch;
+    uint8_t batch[MIDI_PARSER_BATCH_SIZE];
+    int batch_len;
+    
+    midi_parser_callback *send_realtime;
+    
+    midi_parser_sysex_callback *send_sysex;
+    int sysex_fragment_size;
+    int sysex_started;
 } midi_parser;
 
 void midi_parser_init(midi_parser * parser, midi_parser_callback *callback, void *user_data);
 void midi_parser_parse(midi_parser * parser, uint8_t byte);
 
+/* same as calling midi_parser_parse for every byte, but channel messages
+ * in running status are parsed without going through the state machine.
+ *
+ * if a batch callback is set, the messages of the buffer are delivered to
+ * it instead, back to back, in as few calls as possible: usually one per
+ * buffer, or one more for every MIDI_PARSER_BATCH_SIZE bytes and sysex.
+ */
+void midi_parser_parse_buffer(midi_parser * parser, const uint8_t *buf, int len);
+void midi_parser_set_batch_callback(midi_parser * parser, midi_parser_callback *callback);
+
+/* real time messages (0xf8 to 0xff) can come in the middle of any other
+ * message, sysex included, and never change the parser state. With a real
+ * time callback they are delivered to it as soon as they're seen, ahead of
+ * the batch; otherwise they go in order with the other messages.
+ */
+void midi_parser_set_realtime_callback(midi_parser * parser, midi_parser_callback *callback);
+
+/* sysex of any length is delivered as it arrives, in fragments of at most
+ * fragment_size bytes, up to MIDI_PARSER_PACKET_SIZE. With a sysex callback
+ * every fragment comes with its MIDI_PARSER_SYSEX_* flags, otherwise the
+ * fragments are sent like any other message, and the host has to put them
+ * back together.
+ */
+void midi_parser_set_sysex_callback(
+    midi_parser * parser,
+    midi_parser_sysex_callback *callback,
+    int fragment_size
+);
+
 #endif /* midi_state_machine_h */
@@ -0,0 +1,162 @@
+//
+//  pad-state-machine.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "pad-state-machine.h"
+#include <string.h>
+
+void pad_engine_default_config(pad_engine_config *config) {
+    config->note_on_threshold  = 200;
+    config->note_off_threshold = 100;
+    config->attack_reports     = 1;
+    config->attack_full_scale  = 2048;
+    config->channel            = 9;
+    config->base_note          = 36;
+    
+    for (int i = 0; i < 128; i++)
+        config->velocity_curve[i] = i;
+}
+
+void pad_engine_init(pad_engine *engine, pad_engine_callback *callback, void *user_data) {
+    memset(engine, 0, sizeof(pad_engine));
+    
+    pad_engine_default_config(&engine->config);
+    
+    engine->send = callback;
+    engine->user_data = user_data;
+}
+
+int pad_engine_config_valid(const pad_engine_config *config) {
+    return config->note_on_threshold <= 0x0fff &&
+           config->note_off_threshold <= config->note_on_threshold &&
+           config->attack_reports >= 1 &&
+           config->attack_full_scale != 0 &&
+           config->channel <= 15 &&
+           config->base_note + PAD_ENGINE_PADS - 1 <= 127;
+}
+
+int pad_engine_set_config(pad_engine *engine, const pad_engine_config *config) {
+    if (!pad_engine_config_valid(config))
+        return -1;
+    
+    engine->config = *config;
+    
+    return 0;
+}
+
+void pad_engine_set_velocity_curve(pad_engine *engine, const uint8_t curve[128]) {
+    memcpy(engine->config.velocity_curve, curve, sizeof(engine->config.velocity_curve));
+}
+
+static uint8_t velocity_for_attack(pad_engine_config *config, int slope) {
+    int index = slope * 127 / config->attack_full_scale;
+    
+    if (index < 1)
+        index = 1;
+    
+    if (index > 127)
+        index = 127;
+    
+    uint8_t velocity = config->velocity_curve[index];
+    
+    /* a note on with velocity 0 is a note off */
+    return velocity ? velocity : 1;
+}
+
+static int pad_update(pad_engine *engine, int pad_id, uint16_t pressure) {
+    pad_engine_config *config = &engine->config;
+    pad *p = &engine->pads[pad_id];
+    
+    uint8_t note = config->base_note + pad_id;
+    uint8_t message[3];
+    int sent = 0;
+    
+    uint16_t previous = p->pressure;
+    p->pressure = pressure;
+    
+    switch (p->state) {
+        case pad_state_idle:
+            if (pressure < config->note_on_threshold)
+                break;
+            
+            /* the crossing report is already part of the attack */
+            p->state = pad_state_attack;
+            p->attack_start = previous;
+            p->attack_reports = 0;
+            
+            /* fall through */
+            
+        case pad_state_attack:
+            p->attack_reports++;
+            
+            if (pressure < config->note_off_threshold) {
+                p->state = pad_state_idle;
+                break;
+            }
+            
+            if (p->attack_reports < config->attack_reports)
+                break;
+            
+            /* the note off and aftertouch go to the same note, even if
+             * the config changes while the pad is down
+             */
+            p->note = note;
+            p->channel = config->channel;
+            
+            message[0] = 0x90 | p->channel;
+            message[1] = p->note;
+            message[2] = velocity_for_attack(config, pressure - p->attack_start);
+            engine->send(message, 3, engine->user_data);
+            sent++;
+            
+            p->state = pad_state_held;
+            p->aftertouch = 0;
+            break;
+            
+        case pad_state_held:
+            if (pressure < config->note_off_threshold) {
+                message[0] = 0x80 | p->channel;
+                message[1] = p->note;
+                message[2] = 0;
+                engine->send(message, 3, engine->user_data);
+                sent++;
+                
+                p->state = pad_state_idle;
+                break;
+            }
+            
+            uint8_t aftertouch = pressure >> 5;
+            
+            if (aftertouch != p->aftertouch) {
+                message[0] = 0xa0 | p->channel;
+                message[1] = p->note;
+                message[2] = aftertouch;
+                engine->send(message, 3, engine->user_data);
+                sent++;
+                
+                p->aftertouch = aftertouch;
+            }
+            
+            break;
+    }
+    
+    return sent;
+}
+
+int pad_engine_process_report(pad_engine *engine, const uint8_t *report, int len) {
+    int sent = 0;
+    
+    for (int i = 0; i < PAD_ENGINE_PADS && (i * 2 + 1) < len; i++) {
+        uint16_t value    = report[i * 2] | (report[i * 2 + 1] << 8);
+        uint16_t pad_id   = (value & 0xf000) >> 12;
+        uint16_t pressure = (value & 0x0fff);
+        
+        sent += pad_update(engine, pad_id, pressure);
+    }
+    
+    return sent;
+}
@@ -0,0 +1,90 @@
+//
+//  pad-state-machine.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef pad_state_machine_h
+#define pad_state_machine_h
+
+#include <stdint.h>
+
+#define PAD_ENGINE_PADS 16
+
+typedef enum {
+    pad_state_idle,
+    pad_state_attack,
+    pad_state_held,
+} pad_state;
+
+typedef void (pad_engine_callback)(uint8_t *buf, int len, void *user_data);
+
+typedef struct {
+    /* pressures are the raw 12 bits values from the pad reports */
+    uint16_t note_on_threshold;
+    uint16_t note_off_threshold;
+    
+    /* how many reports, counting the one crossing the threshold, to look
+     * at before deciding the velocity. 1 sends the note right away
+     */
+    int attack_reports;
+    
+    /* pressure increase over the attack that maps to full velocity */
+    uint16_t attack_full_scale;
+    
+    uint8_t channel;
+    uint8_t base_note;
+    
+    uint8_t velocity_curve[128];
+} pad_engine_config;
+
+typedef struct {
+    pad_state state;
+    uint16_t pressure;
+    uint16_t attack_start;
+    int attack_reports;
+    uint8_t aftertouch;
+    
+    /* of the note on, while the pad is held */
+    uint8_t channel;
+    uint8_t note;
+} pad;
+
+typedef struct {
+    pad_engine_config config;
+    pad pads[PAD_ENGINE_PADS];
+    
+    pad_engine_callback *send;
+    void *user_data;
+} pad_engine;
+
+/* what pad_engine_init starts with: notes from 36 on channel 10, on
+ * above 200 and off below 100, velocity from the first report
+ */
+void pad_engine_default_config(pad_engine_config *config);
+
+void pad_engine_init(pad_engine *engine, pad_engine_callback *callback, void *user_data);
+
+/* 0 if the note off threshold is above the note on one, the note on
+ * threshold doesn't fit 12 bits, attack_reports is less than 1,
+ * attack_full_scale is 0, or the channel or the notes are out of the
+ * MIDI range
+ */
+int  pad_engine_config_valid(const pad_engine_config *config);
+
+/* takes effect from the next report, pads that are down keep their note
+ * and go by the new thresholds. Returns -1 and changes nothing if the
+ * config isn't valid
+ */
+int  pad_engine_set_config(pad_engine *engine, const pad_engine_config *config);
+
+void pad_engine_set_velocity_curve(pad_engine *engine, const uint8_t curve[128]);
+
+/* decodes an EP4 report and sends note on, poly aftertouch and note off
+ * messages for the pads that changed, returns how many were sent
+ */
+int pad_engine_process_report(pad_engine *engine, const uint8_t *report, int len);
+
+#endif /* pad_state_machine_h */
@@ -0,0 +1,108 @@
+//
+//  spsc-ring.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "spsc-ring.h"
+#include "driver-log.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+
+int spsc_ring_init(spsc_ring *ring, void *storage, unsigned int capacity, unsigned int element_size) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        driver_log("spsc ring capacity %u is not a power of two\n", capacity);
+        return -1;
+    }
+    
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overflows, 0);
+    
+    ring->storage = storage;
+    ring->capacity = capacity;
+    ring->element_size = element_size;
+    
+    if (pipe(ring->wakeup_fds) != 0) {
+        driver_log("cannot create spsc ring wakeup pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        fcntl(ring->wakeup_fds[i], F_SETFL, fcntl(ring->wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(ring->wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    
+    return 0;
+}
+
+void spsc_ring_destroy(spsc_ring *ring) {
+    close(ring->wakeup_fds[0]);
+    close(ring->wakeup_fds[1]);
+    
+    ring->wakeup_fds[0] = -1;
+    ring->wakeup_fds[1] = -1;
+}
+
+void *spsc_ring_reserve(spsc_ring *ring) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    
+    if (head - tail >= ring->capacity) {
+        atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+        return NULL;
+    }
+    
+    return ring->storage + (head & (ring->capacity - 1)) * ring->element_size;
+}
+
+void spsc_ring_commit(spsc_ring *ring) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    
+    /* both the publish and the emptiness check are sequentially consistent,
+     * pairing with spsc_ring_release and spsc_ring_peek: either the
+     * consumer sees the new element before going to sleep, or we see
+     * that it emptied the ring and wake it up
+     */
+    
+    atomic_store(&ring->head, head + 1);
+    
+    if (atomic_load(&ring->tail) == head) {
+        uint8_t byte = 0;
+        
+        /* a full pipe means that a wakeup is already pending */
+        ssize_t r = write(ring->wakeup_fds[1], &byte, 1);
+        (void)r;
+    }
+}
+
+void *spsc_ring_peek(spsc_ring *ring) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load(&ring->head);
+    
+    if (head == tail)
+        return NULL;
+    
+    return ring->storage + (tail & (ring->capacity - 1)) * ring->element_size;
+}
+
+void spsc_ring_release(spsc_ring *ring) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store(&ring->tail, tail + 1);
+}
+
+int spsc_ring_wakeup_fd(spsc_ring *ring) {
+    return ring->wakeup_fds[0];
+}
+
+void spsc_ring_clear_wakeup(spsc_ring *ring) {
+    uint8_t bytes[64];
+    
+    while (read(ring->wakeup_fds[0], bytes, sizeof(bytes)) > 0)
+        ;
+}
@@ -0,0 +1,56 @@
+//
+//  spsc-ring.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef spsc_ring_h
+#define spsc_ring_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* single producer, single consumer ring of fixed size elements.
+ *
+ * the producer reserves a slot, fills it and commits it, the consumer
+ * peeks the oldest slot and releases it when done. neither side ever
+ * blocks or takes a lock.
+ *
+ * when the producer commits into an empty ring it also writes a byte to
+ * a pipe, so that the consumer can sleep in poll() on spsc_ring_wakeup_fd
+ */
+
+typedef struct {
+    _Atomic unsigned int head;
+    uint8_t pad0[60];
+    
+    _Atomic unsigned int tail;
+    uint8_t pad1[60];
+    
+    uint8_t *storage;
+    unsigned int capacity;
+    unsigned int element_size;
+    
+    int wakeup_fds[2];
+    
+    _Atomic unsigned int overflows;
+} spsc_ring;
+
+/* capacity must be a power of two, storage must hold capacity elements */
+int  spsc_ring_init(spsc_ring *ring, void *storage, unsigned int capacity, unsigned int element_size);
+void spsc_ring_destroy(spsc_ring *ring);
+
+/* producer side */
+void *spsc_ring_reserve(spsc_ring *ring);
+void  spsc_ring_commit(spsc_ring *ring);
+
+/* consumer side */
+void *spsc_ring_peek(spsc_ring *ring);
+void  spsc_ring_release(spsc_ring *ring);
+
+int  spsc_ring_wakeup_fd(spsc_ring *ring);
+void spsc_ring_clear_wakeup(spsc_ring *ring);
+
+#endif /* spsc_ring_h */
@@ -0,0 +1,803 @@
+//
+//  usb-simulator.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifdef USB_SIMULATOR
+
+#include "usb-simulator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { SIM_IN_TRANSFERS_MAX = 16 };
+enum { SIM_RESPONSES_MAX    = 64 };
+enum { SIM_RESPONSE_SIZE    = 64 };
+enum { SIM_SCHEDULED_MAX    = 1024 };
+
+enum { SIM_PAD_REPORT_SIZE = 32 };
+enum { SIM_IO_REPORT_SIZE  = 8 };
+enum { SIM_ERP_REPORT_SIZE = 22 };
+
+/* the EP1 command bytes, as in main.c */
+enum {
+    SIM_CMD_GET_DEVICE_INFO = 0x1,
+    SIM_CMD_READ_ERP        = 0x2,
+    SIM_CMD_READ_IO         = 0x4,
+    SIM_CMD_MIDI_READ       = 0x6,
+    SIM_CMD_MIDI_WRITE      = 0x7,
+    SIM_CMD_AUTO_MSG        = 0xb,
+};
+
+enum sim_transfer_state {
+    sim_transfer_idle,
+    sim_transfer_waiting,   /* an IN transfer waiting for data */
+    sim_transfer_scheduled, /* due to complete */
+};
+
+/* libusb_alloc_transfer hands out the public part of this */
+struct sim_transfer {
+    struct libusb_transfer transfer;
+    enum sim_transfer_state state;
+    uint64_t due;
+    uint64_t sequence;
+};
+
+struct sim_in_endpoint {
+    struct sim_transfer *waiting[SIM_IN_TRANSFERS_MAX];
+    int count;
+};
+
+struct libusb_device {
+    int index;
+};
+
+struct libusb_device_handle {
+    libusb_device *device;
+};
+
+struct sim_device {
+    libusb_device device;
+    libusb_device_handle handle;
+    
+    int plugged;
+    int open;
+    int auto_messages;
+    
+    uint64_t bus_free_at;
+    
+    struct sim_in_endpoint ep1_in;
+    struct sim_in_endpoint ep4_in;
+    
+    /* EP1 replies waiting for an IN transfer */
+    uint8_t responses[SIM_RESPONSES_MAX][SIM_RESPONSE_SIZE];
+    int response_len[SIM_RESPONSES_MAX];
+    int responses_first;
+    int responses_count;
+    
+    uint64_t next_pad_report;
+    uint64_t next_io_report;
+    uint64_t next_erp_report;
+    
+    unsigned int pad_step;
+    unsigned int io_step;
+    unsigned int erp_step;
+    
+    usb_simulator_stats stats;
+};
+
+static usb_simulator_config config;
+static int configured = 0;
+
+static struct sim_device devices[USB_SIMULATOR_MAX_DEVICES];
+
+static struct sim_transfer *scheduled[SIM_SCHEDULED_MAX];
+static int scheduled_count = 0;
+static uint64_t next_sequence = 0;
+
+static libusb_hotplug_callback_fn hotplug_callback = NULL;
+static void *hotplug_user_data = NULL;
+
+static uint64_t sim_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t sim_period_ns(unsigned int hz) {
+    return hz ? 1000000000ull / hz : 0;
+}
+
+static struct sim_device *sim_device_for(libusb_device_handle *handle) {
+    return &devices[handle->device->index];
+}
+
+/* - configuration */
+
+void usb_simulator_default_config(usb_simulator_config *c) {
+    memset(c, 0, sizeof(usb_simulator_config));
+    
+    c->devices          = 1;
+    c->latency_ns       = 125000;
+    c->bytes_per_second = 1000000;
+    c->pad_reports_hz   = 1000;
+    c->io_reports_hz    = 10;
+    c->erp_reports_hz   = 100;
+    c->midi_loopback    = 0;
+}
+
+int usb_simulator_parse_config(usb_simulator_config *c, const char *spec) {
+    char key[32];
+    unsigned long long value;
+    int consumed;
+    
+    while (*spec) {
+        if (sscanf(spec, "%31[^=]=%llu%n", key, &value, &consumed) != 2) {
+            printf("usb simulator: cannot parse \"%s\"\n", spec);
+            return -1;
+        }
+        
+        if      (strcmp(key, "devices")       == 0) c->devices          = (int)value;
+        else if (strcmp(key, "latency_us")    == 0) c->latency_ns       = value * 1000;
+        else if (strcmp(key, "kbps")          == 0) c->bytes_per_second = value * 1000;
+        else if (strcmp(key, "pads_hz")       == 0) c->pad_reports_hz   = (unsigned int)value;
+        else if (strcmp(key, "io_hz")         == 0) c->io_reports_hz    = (unsigned int)value;
+        else if (strcmp(key, "erp_hz")        == 0) c->erp_reports_hz   = (unsigned int)value;
+        else if (strcmp(key, "midi_loopback") == 0) c->midi_loopback    = value != 0;
+        else {
+            printf("usb simulator: unknown setting %s\n", key);
+            return -1;
+        }
+        
+        spec += consumed;
+        
+        if (*spec == ',')
+            spec++;
+    }
+    
+    if (c->devices > USB_SIMULATOR_MAX_DEVICES)
+        c->devices = USB_SIMULATOR_MAX_DEVICES;
+    
+    return 0;
+}
+
+void usb_simulator_configure(const usb_simulator_config *c) {
+    config = *c;
+    configured = 1;
+}
+
+void usb_simulator_get_stats(int device, usb_simulator_stats *stats) {
+    *stats = devices[device].stats;
+}
+
+/* - scheduling */
+
+/* when a transfer of len bytes gets through the bus of the device */
+static uint64_t sim_bus_done(struct sim_device *dev, int len, uint64_t now) {
+    uint64_t start = dev->bus_free_at > now ? dev->bus_free_at : now;
+    uint64_t duration = config.bytes_per_second
+        ? (uint64_t)len * 1000000000ull / config.bytes_per_second
+        : 0;
+    
+    dev->bus_free_at = start + duration;
+    
+    return dev->bus_free_at + config.latency_ns;
+}
+
+static void sim_schedule(
+    struct sim_transfer *t,
+    uint64_t due,
+    enum libusb_transfer_status status,
+    int actual_length
+) {
+    t->transfer.status        = status;
+    t->transfer.actual_length = actual_length;
+    t->state                  = sim_transfer_scheduled;
+    t->due                    = due;
+    t->sequence               = next_sequence++;
+    
+    scheduled[scheduled_count++] = t;
+}
+
+static void sim_unschedule(struct sim_transfer *t) {
+    for (int i = 0; i < scheduled_count; i++) {
+        if (scheduled[i] == t) {
+            scheduled[i] = scheduled[--scheduled_count];
+            break;
+        }
+    }
+    
+    t->state = sim_transfer_idle;
+}
+
+static struct sim_transfer *sim_in_endpoint_pop(struct sim_in_endpoint *endpoint) {
+    if (endpoint->count == 0)
+        return NULL;
+    
+    struct sim_transfer *t = endpoint->waiting[0];
+    
+    endpoint->count--;
+    memmove(&endpoint->waiting[0], &endpoint->waiting[1], endpoint->count * sizeof(struct sim_transfer *));
+    
+    return t;
+}
+
+static int sim_in_endpoint_remove(struct sim_in_endpoint *endpoint, struct sim_transfer *t) {
+    for (int i = 0; i < endpoint->count; i++) {
+        if (endpoint->waiting[i] == t) {
+            endpoint->count--;
+            memmove(&endpoint->waiting[i], &endpoint->waiting[i + 1], (endpoint->count - i) * sizeof(struct sim_transfer *));
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/* completes the oldest waiting IN transfer with data, returns 0 if there
+ * was none
+ */
+static int sim_in_deliver(
+    struct sim_device *dev,
+    struct sim_in_endpoint *endpoint,
+    usb_simulator_endpoint_stats *stats,
+    const uint8_t *data,
+    int len,
+    uint64_t now
+) {
+    struct sim_transfer *t = sim_in_endpoint_pop(endpoint);
+    
+    if (t == NULL) {
+        stats->dropped++;
+        return 0;
+    }
+    
+    if (len > t->transfer.length)
+        len = t->transfer.length;
+    
+    memcpy(t->transfer.buffer, data, len);
+    sim_schedule(t, sim_bus_done(dev, len, now), LIBUSB_TRANSFER_COMPLETED, len);
+    
+    stats->transfers++;
+    stats->bytes += len;
+    
+    return 1;
+}
+
+static void sim_deliver_responses(struct sim_device *dev, uint64_t now) {
+    while (dev->responses_count > 0 && dev->ep1_in.count > 0) {
+        int first = dev->responses_first;
+        
+        sim_in_deliver(dev, &dev->ep1_in, &dev->stats.ep1_in, dev->responses[first], dev->response_len[first], now);
+        
+        dev->responses_first = (first + 1) % SIM_RESPONSES_MAX;
+        dev->responses_count--;
+    }
+}
+
+static void sim_respond(struct sim_device *dev, const uint8_t *data, int len, uint64_t now) {
+    if (dev->responses_count == SIM_RESPONSES_MAX) {
+        dev->stats.ep1_in.dropped++;
+        return;
+    }
+    
+    int last = (dev->responses_first + dev->responses_count) % SIM_RESPONSES_MAX;
+    
+    memcpy(dev->responses[last], data, len);
+    dev->response_len[last] = len;
+    dev->responses_count++;
+    
+    sim_deliver_responses(dev, now);
+}
+
+/* - the emulated unit */
+
+static void sim_handle_command(struct sim_device *dev, const uint8_t *command, int len, uint64_t now) {
+    if (len < 1)
+        return;
+    
+    switch (command[0]) {
+        case SIM_CMD_GET_DEVICE_INFO:
+        {
+            /* struct caiaq_device_spec: firmware 1.00, 11 ERPs, 1 MIDI in and out */
+            uint8_t reply[] = {
+                SIM_CMD_GET_DEVICE_INFO,
+                0x00, 0x01, 0x00, 11, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+            };
+            
+            sim_respond(dev, reply, sizeof(reply), now);
+            break;
+        }
+        
+        case SIM_CMD_AUTO_MSG:
+            dev->auto_messages   = 1;
+            dev->next_io_report  = now + sim_period_ns(config.io_reports_hz);
+            dev->next_erp_report = now + sim_period_ns(config.erp_reports_hz);
+            break;
+        
+        case SIM_CMD_MIDI_WRITE:
+        {
+            if (!config.midi_loopback || len < 3)
+                break;
+            
+            uint8_t reply[SIM_RESPONSE_SIZE];
+            int data_len = len - 3;
+            
+            if (data_len > SIM_RESPONSE_SIZE - 3)
+                data_len = SIM_RESPONSE_SIZE - 3;
+            
+            reply[0] = SIM_CMD_MIDI_READ;
+            reply[1] = 0;
+            reply[2] = data_len;
+            memcpy(reply + 3, command + 3, data_len);
+            
+            sim_respond(dev, reply, data_len + 3, now);
+            break;
+        }
+        
+        default:
+            break;
+    }
+}
+
+/* the pads are pressed one after the other: 8 reports rising up to 1600,
+ * 8 holding, 8 releasing
+ */
+static void sim_pad_report(struct sim_device *dev, uint8_t report[SIM_PAD_REPORT_SIZE]) {
+    unsigned int phase = dev->pad_step % 24;
+    unsigned int pad   = (dev->pad_step / 24) % 16;
+    unsigned int pressure;
+    
+    if (phase < 8)
+        pressure = (phase + 1) * 200;
+    else if (phase < 16)
+        pressure = 1600;
+    else
+        pressure = (23 - phase) * 200;
+    
+    for (unsigned int i = 0; i < 16; i++) {
+        uint16_t value = (i << 12) | (i == pad ? pressure : 0);
+        
+        report[i * 2]     = value & 0xff;
+        report[i * 2 + 1] = value >> 8;
+    }
+    
+    dev->pad_step++;
+}
+
+/* presses and releases the buttons one after the other */
+static void sim_io_report(struct sim_device *dev, uint8_t report[SIM_IO_REPORT_SIZE + 1]) {
+    uint64_t pressed = (dev->io_step & 1) ? 0 : 1ull << ((dev->io_step / 2) % 32);
+    
+    report[0] = SIM_CMD_READ_IO;
+    
+    for (int i = 0; i < SIM_IO_REPORT_SIZE; i++)
+        report[i + 1] = (pressed >> (i * 8)) & 0xff;
+    
+    dev->io_step++;
+}
+
+/* one of the two tapers of an encoder, see decode_erp */
+static uint8_t sim_erp_taper(int phase) {
+    phase %= 550;
+    
+    int value = phase < 275 ? phase - 7 : 543 - phase;
+    
+    if (value < 0)
+        value = 0;
+    
+    if (value > 255)
+        value = 255;
+    
+    return value;
+}
+
+/* turns all the encoders slowly clockwise, a and b 90 degrees apart */
+static void sim_erp_report(struct sim_device *dev, uint8_t report[SIM_ERP_REPORT_SIZE + 1]) {
+    int phase = dev->erp_step * 5;
+    
+    report[0] = SIM_CMD_READ_ERP;
+    
+    for (int i = 0; i < SIM_ERP_REPORT_SIZE; i += 2) {
+        report[1 + i + 1] = sim_erp_taper(phase);
+        report[1 + i]     = sim_erp_taper(phase + 550 / 4);
+    }
+    
+    dev->erp_step++;
+}
+
+static void sim_produce_reports(struct sim_device *dev, uint64_t now) {
+    if (config.pad_reports_hz && now >= dev->next_pad_report) {
+        uint8_t report[SIM_PAD_REPORT_SIZE];
+        
+        sim_pad_report(dev, report);
+        sim_in_deliver(dev, &dev->ep4_in, &dev->stats.ep4_in, report, sizeof(report), now);
+        
+        dev->next_pad_report += sim_period_ns(config.pad_reports_hz);
+        
+        if (dev->next_pad_report <= now)
+            dev->next_pad_report = now + sim_period_ns(config.pad_reports_hz);
+    }
+    
+    if (!dev->auto_messages)
+        return;
+    
+    if (config.io_reports_hz && now >= dev->next_io_report) {
+        uint8_t report[SIM_IO_REPORT_SIZE + 1];
+        
+        sim_io_report(dev, report);
+        sim_respond(dev, report, sizeof(report), now);
+        
+        dev->next_io_report += sim_period_ns(config.io_reports_hz);
+        
+        if (dev->next_io_report <= now)
+            dev->next_io_report = now + sim_period_ns(config.io_reports_hz);
+    }
+    
+    if (config.erp_reports_hz && now >= dev->next_erp_report) {
+        uint8_t report[SIM_ERP_REPORT_SIZE + 1];
+        
+        sim_erp_report(dev, report);
+        sim_respond(dev, report, sizeof(report), now);
+        
+        dev->next_erp_report += sim_period_ns(config.erp_reports_hz);
+        
+        if (dev->next_erp_report <= now)
+            dev->next_erp_report = now + sim_period_ns(config.erp_reports_hz);
+    }
+}
+
+/* - libusb */
+
+int libusb_init(libusb_context **ctx) {
+    if (!configured) {
+        const char *spec = getenv("USB_SIMULATOR");
+        
+        usb_simulator_default_config(&config);
+        
+        if (spec && usb_simulator_parse_config(&config, spec) != 0)
+            return LIBUSB_ERROR_INVALID_PARAM;
+        
+        configured = 1;
+    }
+    
+    memset(devices, 0, sizeof(devices));
+    
+    for (int i = 0; i < USB_SIMULATOR_MAX_DEVICES; i++) {
+        devices[i].device.index  = i;
+        devices[i].handle.device = &devices[i].device;
+        devices[i].plugged       = i < config.devices;
+    }
+    
+    scheduled_count = 0;
+    
+    /* there's only the one bus */
+    if (ctx)
+        *ctx = NULL;
+    
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_exit(libusb_context *ctx) {
+    hotplug_callback = NULL;
+    configured = 0;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle) {
+    struct sim_device *sim = &devices[dev->index];
+    
+    if (!sim->plugged)
+        return LIBUSB_ERROR_NO_DEVICE;
+    
+    sim->open = 1;
+    sim->next_pad_report = sim_now_ns() + sim_period_ns(config.pad_reports_hz);
+    
+    *dev_handle = &sim->handle;
+    
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_close(libusb_device_handle *dev_handle) {
+    struct sim_device *sim = sim_device_for(dev_handle);
+    
+    sim->open = 0;
+    sim->auto_messages = 0;
+    sim->responses_count = 0;
+}
+
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle) {
+    return dev_handle->device;
+}
+
+/* the simulated devices are never freed */
+libusb_device *libusb_ref_device(libusb_device *dev) {
+    return dev;
+}
+
+void libusb_unref_device(libusb_device *dev) {
+}
+
+int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number) {
+    return sim_device_for(dev_handle)->plugged ? LIBUSB_SUCCESS : LIBUSB_ERROR_NO_DEVICE;
+}
+
+int libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting) {
+    return sim_device_for(dev_handle)->plugged ? LIBUSB_SUCCESS : LIBUSB_ERROR_NO_DEVICE;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets) {
+    struct sim_transfer *t = calloc(1, sizeof(struct sim_transfer));
+    
+    return t ? &t->transfer : NULL;
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer) {
+    free((struct sim_transfer *)transfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer) {
+    struct sim_transfer *t = (struct sim_transfer *)transfer;
+    struct sim_device *dev = sim_device_for(transfer->dev_handle);
+    uint64_t now = sim_now_ns();
+    
+    if (!dev->plugged || !dev->open)
+        return LIBUSB_ERROR_NO_DEVICE;
+    
+    if (t->state != sim_transfer_idle)
+        return LIBUSB_ERROR_BUSY;
+    
+    if (scheduled_count == SIM_SCHEDULED_MAX)
+        return LIBUSB_ERROR_NO_MEM;
+    
+    switch (transfer->endpoint) {
+        case 0x01:
+            dev->stats.ep1_out.transfers++;
+            dev->stats.ep1_out.bytes += transfer->length;
+            sim_schedule(t, sim_bus_done(dev, transfer->length, now), LIBUSB_TRANSFER_COMPLETED, transfer->length);
+            return LIBUSB_SUCCESS;
+        
+        case 0x08:
+            dev->stats.ep8_out.transfers++;
+            dev->stats.ep8_out.bytes += transfer->length;
+            sim_schedule(t, sim_bus_done(dev, transfer->length, now), LIBUSB_TRANSFER_COMPLETED, transfer->length);
+            return LIBUSB_SUCCESS;
+        
+        case 0x81:
+        case 0x84:
+        {
+            struct sim_in_endpoint *endpoint = transfer->endpoint == 0x81 ? &dev->ep1_in : &dev->ep4_in;
+            
+            if (endpoint->count == SIM_IN_TRANSFERS_MAX)
+                return LIBUSB_ERROR_NO_MEM;
+            
+            endpoint->waiting[endpoint->count++] = t;
+            t->state = sim_transfer_waiting;
+            
+            if (transfer->endpoint == 0x81)
+                sim_deliver_responses(dev, now);
+            
+            return LIBUSB_SUCCESS;
+        }
+        
+        default:
+            return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+}
+
+static void sim_abort(struct sim_transfer *t, enum libusb_transfer_status status, uint64_t now) {
+    struct sim_device *dev = sim_device_for(t->transfer.dev_handle);
+    
+    switch (t->state) {
+        case sim_transfer_idle:
+            return;
+        
+        case sim_transfer_waiting:
+            if (!sim_in_endpoint_remove(&dev->ep1_in, t))
+                sim_in_endpoint_remove(&dev->ep4_in, t);
+            break;
+        
+        case sim_transfer_scheduled:
+            sim_unschedule(t);
+            break;
+    }
+    
+    sim_schedule(t, now, status, 0);
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer) {
+    struct sim_transfer *t = (struct sim_transfer *)transfer;
+    
+    if (t->state == sim_transfer_idle)
+        return LIBUSB_ERROR_NOT_FOUND;
+    
+    /* already cancelled, or failing anyway */
+    if (t->state == sim_transfer_scheduled && transfer->status != LIBUSB_TRANSFER_COMPLETED)
+        return LIBUSB_SUCCESS;
+    
+    sim_abort(t, LIBUSB_TRANSFER_CANCELLED, sim_now_ns());
+    
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv) {
+    uint64_t now = sim_now_ns();
+    
+    for (int i = 0; i < USB_SIMULATOR_MAX_DEVICES; i++) {
+        if (devices[i].plugged && devices[i].open)
+            sim_produce_reports(&devices[i], now);
+    }
+    
+    /* transfers submitted from the callbacks wait for the next call, like
+     * they would with libusb
+     */
+    uint64_t last_sequence = next_sequence;
+    
+    while (1) {
+        int earliest = -1;
+        
+        for (int i = 0; i < scheduled_count; i++) {
+            struct sim_transfer *t = scheduled[i];
+            
+            if (t->due > now || t->sequence >= last_sequence)
+                continue;
+            
+            if (earliest < 0 || t->due < scheduled[earliest]->due ||
+                (t->due == scheduled[earliest]->due && t->sequence < scheduled[earliest]->sequence))
+                earliest = i;
+        }
+        
+        if (earliest < 0)
+            break;
+        
+        struct sim_transfer *t = scheduled[earliest];
+        struct libusb_transfer *transfer = &t->transfer;
+        
+        sim_unschedule(t);
+        
+        if (transfer->endpoint == 0x01 && transfer->status == LIBUSB_TRANSFER_COMPLETED)
+            sim_handle_command(sim_device_for(transfer->dev_handle), transfer->buffer, transfer->length, now);
+        
+        transfer->callback(transfer);
+    }
+    
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_get_next_timeout(libusb_context *ctx, struct timeval *tv) {
+    uint64_t now = sim_now_ns();
+    uint64_t next = UINT64_MAX;
+    
+    for (int i = 0; i < scheduled_count; i++) {
+        if (scheduled[i]->due < next)
+            next = scheduled[i]->due;
+    }
+    
+    for (int i = 0; i < USB_SIMULATOR_MAX_DEVICES; i++) {
+        struct sim_device *dev = &devices[i];
+        
+        if (!dev->plugged || !dev->open)
+            continue;
+        
+        if (config.pad_reports_hz && dev->next_pad_report < next)
+            next = dev->next_pad_report;
+        
+        if (dev->auto_messages && config.io_reports_hz && dev->next_io_report < next)
+            next = dev->next_io_report;
+        
+        if (dev->auto_messages && config.erp_reports_hz && dev->next_erp_report < next)
+            next = dev->next_erp_report;
+    }
+    
+    if (next == UINT64_MAX)
+        return 0;
+    
+    uint64_t timeout = next > now ? next - now : 0;
+    
+    tv->tv_sec  = timeout / 1000000000ull;
+    tv->tv_usec = (timeout % 1000000000ull) / 1000;
+    
+    return 1;
+}
+
+/* everything is driven by libusb_get_next_timeout, there are no file
+ * descriptors to wait on
+ */
+const struct libusb_pollfd **libusb_get_pollfds(libusb_context *ctx) {
+    return calloc(1, sizeof(struct libusb_pollfd *));
+}
+
+void libusb_free_pollfds(const struct libusb_pollfd **pollfds) {
+    free((void *)pollfds);
+}
+
+void libusb_set_pollfd_notifiers(
+    libusb_context *ctx,
+    libusb_pollfd_added_cb added_cb,
+    libusb_pollfd_removed_cb removed_cb,
+    void *user_data
+) {
+}
+
+int libusb_hotplug_register_callback(
+    libusb_context *ctx,
+    int events,
+    int flags,
+    int vendor_id,
+    int product_id,
+    int dev_class,
+    libusb_hotplug_callback_fn cb_fn,
+    void *user_data,
+    libusb_hotplug_callback_handle *callback_handle
+) {
+    hotplug_callback  = cb_fn;
+    hotplug_user_data = user_data;
+    
+    *callback_handle = 1;
+    
+    if (flags & LIBUSB_HOTPLUG_ENUMERATE) {
+        for (int i = 0; i < USB_SIMULATOR_MAX_DEVICES; i++) {
+            if (devices[i].plugged)
+                cb_fn(ctx, &devices[i].device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data);
+        }
+    }
+    
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle) {
+    hotplug_callback  = NULL;
+    hotplug_user_data = NULL;
+}
+
+/* - plugging */
+
+void usb_simulator_plug(int device) {
+    struct sim_device *dev = &devices[device];
+    
+    if (dev->plugged)
+        return;
+    
+    dev->plugged = 1;
+    
+    if (hotplug_callback)
+        hotplug_callback(NULL, &dev->device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, hotplug_user_data);
+}
+
+void usb_simulator_unplug(int device) {
+    struct sim_device *dev = &devices[device];
+    uint64_t now = sim_now_ns();
+    
+    if (!dev->plugged)
+        return;
+    
+    dev->plugged = 0;
+    dev->auto_messages = 0;
+    
+    /* everything in flight fails, like on a real unplug */
+    while (dev->ep1_in.count > 0)
+        sim_abort(dev->ep1_in.waiting[0], LIBUSB_TRANSFER_NO_DEVICE, now);
+    
+    while (dev->ep4_in.count > 0)
+        sim_abort(dev->ep4_in.waiting[0], LIBUSB_TRANSFER_NO_DEVICE, now);
+    
+    for (int i = 0; i < scheduled_count; i++) {
+        struct sim_transfer *t = scheduled[i];
+        
+        if (t->transfer.dev_handle == &dev->handle && t->transfer.status == LIBUSB_TRANSFER_COMPLETED) {
+            t->transfer.status = LIBUSB_TRANSFER_NO_DEVICE;
+            t->transfer.actual_length = 0;
+            t->due = now;
+        }
+    }
+    
+    if (hotplug_callback)
+        hotplug_callback(NULL, &dev->device, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, hotplug_user_data);
+}
+
+#endif /* USB_SIMULATOR */
@@ -0,0 +1,234 @@
+//
+//  usb-simulator.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef usb_simulator_h
+#define usb_simulator_h
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/* a stand-in for the part of libusb the driver uses, talking to emulated
+ * Maschine MK1 units instead of real ones. When the driver is built with
+ * USB_SIMULATOR defined, main.c includes this instead of libusb.h and
+ * usb-simulator.c provides the functions.
+ *
+ * every unit answers on:
+ *   EP1 out/in (0x01/0x81): device info, auto messages, IO and ERP reports,
+ *                           and MIDI read when midi_loopback is set
+ *   EP4 in     (0x84):      pad reports, pressing the pads one at a time
+ *   EP8 out    (0x08):      the displays, data is only counted
+ *
+ * nothing runs on other threads: completions are due at a point in time,
+ * reported through libusb_get_next_timeout, and their callbacks run from
+ * libusb_handle_events_timeout like they would with libusb.
+ */
+
+/* - libusb */
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+enum libusb_error {
+    LIBUSB_SUCCESS             =   0,
+    LIBUSB_ERROR_IO            =  -1,
+    LIBUSB_ERROR_INVALID_PARAM =  -2,
+    LIBUSB_ERROR_NO_DEVICE     =  -4,
+    LIBUSB_ERROR_NOT_FOUND     =  -5,
+    LIBUSB_ERROR_BUSY          =  -6,
+    LIBUSB_ERROR_NO_MEM        = -11,
+    LIBUSB_ERROR_NOT_SUPPORTED = -12,
+};
+
+enum libusb_transfer_status {
+    LIBUSB_TRANSFER_COMPLETED,
+    LIBUSB_TRANSFER_ERROR,
+    LIBUSB_TRANSFER_TIMED_OUT,
+    LIBUSB_TRANSFER_CANCELLED,
+    LIBUSB_TRANSFER_STALL,
+    LIBUSB_TRANSFER_NO_DEVICE,
+    LIBUSB_TRANSFER_OVERFLOW,
+};
+
+enum libusb_transfer_type {
+    LIBUSB_TRANSFER_TYPE_BULK = 2,
+};
+
+struct libusb_transfer;
+
+typedef void (*libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+    libusb_device_handle *dev_handle;
+    uint8_t flags;
+    unsigned char endpoint;
+    unsigned char type;
+    unsigned int timeout;
+    enum libusb_transfer_status status;
+    int length;
+    int actual_length;
+    libusb_transfer_cb_fn callback;
+    void *user_data;
+    unsigned char *buffer;
+    int num_iso_packets;
+};
+
+static inline void libusb_fill_bulk_transfer(
+    struct libusb_transfer *transfer,
+    libusb_device_handle *dev_handle,
+    unsigned char endpoint,
+    unsigned char *buffer,
+    int length,
+    libusb_transfer_cb_fn callback,
+    void *user_data,
+    unsigned int timeout
+) {
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint   = endpoint;
+    transfer->type       = LIBUSB_TRANSFER_TYPE_BULK;
+    transfer->timeout    = timeout;
+    transfer->buffer     = buffer;
+    transfer->length     = length;
+    transfer->user_data  = user_data;
+    transfer->callback   = callback;
+}
+
+struct libusb_pollfd {
+    int fd;
+    short events;
+};
+
+typedef void (*libusb_pollfd_added_cb)(int fd, short events, void *user_data);
+typedef void (*libusb_pollfd_removed_cb)(int fd, void *user_data);
+
+typedef enum {
+    LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED = 1,
+    LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT    = 2,
+} libusb_hotplug_event;
+
+typedef enum {
+    LIBUSB_HOTPLUG_NO_FLAGS  = 0,
+    LIBUSB_HOTPLUG_ENUMERATE = 1,
+} libusb_hotplug_flag;
+
+#define LIBUSB_HOTPLUG_MATCH_ANY -1
+
+typedef int libusb_hotplug_callback_handle;
+
+typedef int (*libusb_hotplug_callback_fn)(
+    libusb_context *ctx,
+    libusb_device *device,
+    libusb_hotplug_event event,
+    void *user_data
+);
+
+int  libusb_init(libusb_context **ctx);
+void libusb_exit(libusb_context *ctx);
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle);
+void libusb_close(libusb_device_handle *dev_handle);
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle);
+libusb_device *libusb_ref_device(libusb_device *dev);
+void libusb_unref_device(libusb_device *dev);
+int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number);
+int libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting);
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer *transfer);
+int  libusb_submit_transfer(struct libusb_transfer *transfer);
+int  libusb_cancel_transfer(struct libusb_transfer *transfer);
+
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv);
+int libusb_get_next_timeout(libusb_context *ctx, struct timeval *tv);
+
+const struct libusb_pollfd **libusb_get_pollfds(libusb_context *ctx);
+void libusb_free_pollfds(const struct libusb_pollfd **pollfds);
+void libusb_set_pollfd_notifiers(
+    libusb_context *ctx,
+    libusb_pollfd_added_cb added_cb,
+    libusb_pollfd_removed_cb removed_cb,
+    void *user_data
+);
+
+int libusb_hotplug_register_callback(
+    libusb_context *ctx,
+    int events,
+    int flags,
+    int vendor_id,
+    int product_id,
+    int dev_class,
+    libusb_hotplug_callback_fn cb_fn,
+    void *user_data,
+    libusb_hotplug_callback_handle *callback_handle
+);
+
+void libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle);
+
+/* - simulator */
+
+enum { USB_SIMULATOR_MAX_DEVICES = 16 };
+
+typedef struct {
+    /* units plugged in when libusb_init is called */
+    int devices;
+    
+    /* from the submission of an OUT transfer, or from the data being ready
+     * for an IN transfer, to its completion
+     */
+    uint64_t latency_ns;
+    
+    /* of each unit's bus, shared by all of its endpoints, 0 for unlimited */
+    uint64_t bytes_per_second;
+    
+    /* how often each report is produced, 0 for never. IO and ERP reports
+     * only start once the driver has enabled the auto messages
+     */
+    unsigned int pad_reports_hz;
+    unsigned int io_reports_hz;
+    unsigned int erp_reports_hz;
+    
+    /* MIDI written on EP1 comes back as MIDI read, like a cable plugged
+     * from the MIDI out to the MIDI in of the unit
+     */
+    int midi_loopback;
+} usb_simulator_config;
+
+typedef struct {
+    uint64_t transfers;
+    uint64_t bytes;
+    
+    /* reports produced while no IN transfer was waiting for them */
+    uint64_t dropped;
+} usb_simulator_endpoint_stats;
+
+typedef struct {
+    usb_simulator_endpoint_stats ep1_out;
+    usb_simulator_endpoint_stats ep1_in;
+    usb_simulator_endpoint_stats ep4_in;
+    usb_simulator_endpoint_stats ep8_out;
+} usb_simulator_stats;
+
+void usb_simulator_default_config(usb_simulator_config *config);
+
+/* parses a comma separated list of settings, for example
+ * "devices=4,latency_us=125,kbps=1000,pads_hz=1000,midi_loopback=1".
+ * Returns -1 on an unknown setting.
+ */
+int usb_simulator_parse_config(usb_simulator_config *config, const char *spec);
+
+/* to be called before libusb_init, which otherwise takes its settings
+ * from the USB_SIMULATOR environment variable
+ */
+void usb_simulator_configure(const usb_simulator_config *config);
+
+void usb_simulator_plug(int device);
+void usb_simulator_unplug(int device);
+
+void usb_simulator_get_stats(int device, usb_simulator_stats *stats);
+
+#endif /* usb_simulator_h */
@@ -0,0 +1,170 @@
+//
+//  usb-trace.c
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#include "usb-trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char usb_trace_magic[8] = { 'S', 'M', 'M', 'T', 'R', 'A', 'C', 'E' };
+
+static size_t usb_trace_padded(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+int usb_trace_create(usb_trace *trace, const char *path, size_t capacity, uint64_t started_at) {
+    memset(trace, 0, sizeof(usb_trace));
+    
+    trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    
+    if (trace->fd < 0) {
+        perror("cannot create the trace");
+        return -1;
+    }
+    
+    if (ftruncate(trace->fd, capacity) != 0) {
+        perror("cannot grow the trace");
+        close(trace->fd);
+        return -1;
+    }
+    
+    trace->map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, 0);
+    
+    if (trace->map == MAP_FAILED) {
+        perror("cannot map the trace");
+        close(trace->fd);
+        return -1;
+    }
+    
+    trace->capacity = capacity;
+    trace->writable = 1;
+    trace->header = (usb_trace_header *)trace->map;
+    
+    memcpy(trace->header->magic, usb_trace_magic, sizeof(usb_trace_magic));
+    trace->header->version     = USB_TRACE_VERSION;
+    trace->header->header_size = sizeof(usb_trace_header);
+    trace->header->started_at  = started_at;
+    
+    return 0;
+}
+
+void usb_trace_add(
+    usb_trace *trace,
+    uint64_t now,
+    enum usb_trace_event event,
+    int unit,
+    uint8_t endpoint,
+    int status,
+    const uint8_t *payload,
+    int length
+) {
+    usb_trace_header *header = trace->header;
+    size_t size = usb_trace_padded(sizeof(usb_trace_record) + length);
+    size_t offset = sizeof(usb_trace_header) + header->records_size;
+    
+    if (offset + size > trace->capacity) {
+        header->dropped++;
+        return;
+    }
+    
+    usb_trace_record *record = (usb_trace_record *)(trace->map + offset);
+    
+    record->timestamp = now - header->started_at;
+    record->event     = event;
+    record->unit      = unit;
+    record->endpoint  = endpoint;
+    record->status    = status;
+    record->length    = length;
+    record->reserved  = 0;
+    
+    if (length)
+        memcpy(record + 1, payload, length);
+    
+    /* the record only counts once it's all there */
+    header->records_size += size;
+    header->records++;
+}
+
+int usb_trace_open(usb_trace *trace, const char *path) {
+    struct stat st;
+    
+    memset(trace, 0, sizeof(usb_trace));
+    
+    trace->fd = open(path, O_RDONLY);
+    
+    if (trace->fd < 0) {
+        perror("cannot open the trace");
+        return -1;
+    }
+    
+    if (fstat(trace->fd, &st) != 0 || (size_t)st.st_size < sizeof(usb_trace_header)) {
+        printf("%s is not a trace\n", path);
+        close(trace->fd);
+        return -1;
+    }
+    
+    trace->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, trace->fd, 0);
+    
+    if (trace->map == MAP_FAILED) {
+        perror("cannot map the trace");
+        close(trace->fd);
+        return -1;
+    }
+    
+    trace->capacity = st.st_size;
+    trace->header = (usb_trace_header *)trace->map;
+    
+    if (memcmp(trace->header->magic, usb_trace_magic, sizeof(usb_trace_magic)) != 0 ||
+        trace->header->version != USB_TRACE_VERSION ||
+        trace->header->header_size != sizeof(usb_trace_header) ||
+        sizeof(usb_trace_header) + trace->header->records_size > trace->capacity) {
+        printf("%s is not a version %d trace\n", path, USB_TRACE_VERSION);
+        usb_trace_close(trace);
+        return -1;
+    }
+    
+    return 0;
+}
+
+const usb_trace_record *usb_trace_next(usb_trace *trace, size_t *offset, const uint8_t **payload) {
+    size_t end = sizeof(usb_trace_header) + trace->header->records_size;
+    size_t at = sizeof(usb_trace_header) + *offset;
+    
+    if (at + sizeof(usb_trace_record) > end)
+        return NULL;
+    
+    const usb_trace_record *record = (const usb_trace_record *)(trace->map + at);
+    size_t size = usb_trace_padded(sizeof(usb_trace_record) + record->length);
+    
+    if (at + size > end)
+        return NULL;
+    
+    *payload = (const uint8_t *)(record + 1);
+    *offset += size;
+    
+    return record;
+}
+
+void usb_trace_close(usb_trace *trace) {
+    size_t used = sizeof(usb_trace_header) + trace->header->records_size;
+    
+    if (trace->writable && trace->header->dropped)
+        printf("trace full, %llu records dropped\n", (unsigned long long)trace->header->dropped);
+    
+    munmap(trace->map, trace->capacity);
+    
+    if (trace->writable && ftruncate(trace->fd, used) != 0)
+        perror("cannot trim the trace");
+    
+    close(trace->fd);
+    memset(trace, 0, sizeof(usb_trace));
+}
@@ -0,0 +1,104 @@
+//
+//  usb-trace.h
+//  simple-maschine-midi
+//
+//  Created by Antonio Malara on 16/10/2026.
+//  Copyright © 2026 Antonio Malara. All rights reserved.
+//
+
+#ifndef usb_trace_h
+#define usb_trace_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a capture of the USB traffic of the driver: every transfer when it's
+ * submitted and when it completes, with the payload that went over the
+ * wire. The file is mapped in memory, so adding a record is a memcpy,
+ * cheap enough for the event thread.
+ *
+ * the file is a usb_trace_header, then records back to back: each one a
+ * usb_trace_record followed by its payload, padded to 8 bytes. Numbers
+ * are in the byte order of the machine that captured them
+ */
+
+enum { USB_TRACE_VERSION = 1 };
+
+/* room for about ten minutes of one unit with its display running */
+enum { USB_TRACE_CAPACITY_DEFAULT = 64 * 1024 * 1024 };
+
+enum usb_trace_event {
+    /* OUT transfers carry their payload when submitted */
+    USB_TRACE_SUBMIT,
+    
+    /* IN transfers carry theirs when completed */
+    USB_TRACE_COMPLETE,
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    
+    /* CLOCK_MONOTONIC when the capture started */
+    uint64_t started_at;
+    
+    /* how many bytes of records follow the header, kept up to date with
+     * every record, so that a trace survives a crash
+     */
+    uint64_t records_size;
+    uint64_t records;
+    uint64_t dropped;
+} usb_trace_header;
+
+typedef struct {
+    /* nanoseconds since started_at */
+    uint64_t timestamp;
+    
+    uint8_t event;
+    uint8_t unit;
+    
+    /* the endpoint address, with 0x80 set for IN */
+    uint8_t endpoint;
+    
+    /* the libusb_transfer_status, on completion */
+    uint8_t status;
+    
+    uint16_t length;
+    uint16_t reserved;
+} usb_trace_record;
+
+typedef struct {
+    int fd;
+    uint8_t *map;
+    size_t capacity;
+    int writable;
+    
+    usb_trace_header *header;
+} usb_trace;
+
+/* the file is grown to capacity while capturing, and trimmed on close.
+ * Records that don't fit are dropped and counted
+ */
+int  usb_trace_create(usb_trace *trace, const char *path, size_t capacity, uint64_t started_at);
+
+void usb_trace_add(
+    usb_trace *trace,
+    uint64_t now,
+    enum usb_trace_event event,
+    int unit,
+    uint8_t endpoint,
+    int status,
+    const uint8_t *payload,
+    int length
+);
+
+/* returns -1 if the file isn't a trace this version can read */
+int  usb_trace_open(usb_trace *trace, const char *path);
+
+/* the record at *offset, and moves it to the next one. NULL at the end */
+const usb_trace_record *usb_trace_next(usb_trace *trace, size_t *offset, const uint8_t **payload);
+
+void usb_trace_close(usb_trace *trace);
+
+#endif /* usb_trace_h */